@@ -0,0 +1,97 @@
+#include "ColorTransform.hh"
+
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace {
+/** The transforms handed out by ColorTransform::get() that are still alive */
+std::map<std::vector<const CustomColor *>,
+         boost::weak_ptr<const ColorTransform>>
+    transforms;
+boost::mutex transformsMtx;
+
+/**
+ * Truncates like adding the float contributions to an integer one channel at
+ * a time used to, so the results are unchanged as long as the multipliers of
+ * a pixel don't mix signs.
+ */
+int16_t contribution(float multiplier, int value) {
+  return static_cast<int16_t>(multiplier * value);
+}
+} // namespace
+
+ColorTransform::ColorTransform(const std::vector<CustomColor::Ptr> &channels_)
+    : channels(channels_), tables(channels_.size()) {
+  for (size_t j = 0; j < channels.size(); j++) {
+    const CustomColor &color = *channels[j];
+    for (int value = 0; value < 256; value++) {
+      int16_t *entry = tables[j].cmyk[value];
+      entry[0] = contribution(color.cMultiplier, value);
+      entry[1] = contribution(color.mMultiplier, value);
+      entry[2] = contribution(color.yMultiplier, value);
+      entry[3] = contribution(color.kMultiplier, value);
+    }
+  }
+}
+
+ColorTransform::Ptr
+ColorTransform::get(const std::vector<CustomColor::Ptr> &channels) {
+  // The live transform keeps its channels alive, so their addresses can't be
+  // reused by other colors while they identify it
+  std::vector<const CustomColor *> key;
+  for (auto &channel : channels)
+    key.push_back(channel.get());
+
+  boost::mutex::scoped_lock lock(transformsMtx);
+  Ptr transform = transforms[key].lock();
+  if (!transform) {
+    for (auto it = transforms.begin(); it != transforms.end();) {
+      if (it->second.expired() && it->first != key)
+        it = transforms.erase(it);
+      else
+        ++it;
+    }
+    transform = Ptr(new ColorTransform(channels));
+    transforms[key] = transform;
+  }
+  return transform;
+}
+
+void ColorTransform::apply(const uint8_t *samples, uint8_t *surface,
+                           size_t count) const {
+  const size_t spp = tables.size();
+  for (size_t i = 0; i < count; i++) {
+    int32_t cmyk[4] = {surface[0], surface[1], surface[2], surface[3]};
+    addPixel(samples, cmyk);
+    surface[0] = clip(cmyk[0]);
+    surface[1] = clip(cmyk[1]);
+    surface[2] = clip(cmyk[2]);
+    surface[3] = clip(cmyk[3]);
+    samples += spp;
+    surface += 4;
+  }
+}
+
+void ColorTransform::toArgb(const uint8_t *samples, uint32_t *target,
+                            size_t count) const {
+  const size_t spp = tables.size();
+  for (size_t i = 0; i < count; i++) {
+    int32_t cmyk[4] = {0, 0, 0, 0};
+    addPixel(samples, cmyk);
+
+    uint32_t C_i = 255 - clip(cmyk[0]);
+    uint32_t M_i = 255 - clip(cmyk[1]);
+    uint32_t Y_i = 255 - clip(cmyk[2]);
+    uint32_t K_i = 255 - clip(cmyk[3]);
+
+    uint32_t R = (C_i * K_i) / 255;
+    uint32_t G = (M_i * K_i) / 255;
+    uint32_t B = (Y_i * K_i) / 255;
+
+    // Write 255 as alpha (fully opaque)
+    target[i] = 255u << 24 | R << 16 | G << 8 | B;
+    samples += spp;
+  }
+}
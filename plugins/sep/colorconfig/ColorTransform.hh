@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "CustomColor.hh"
+
+/**
+ * The conversion of the samples of a set of channels to CMYK, compiled once
+ * so the pixel kernels only do table lookups and integer additions.
+ *
+ * For every channel, a table holds the C, M, Y and K contribution of each of
+ * the 256 sample values, so converting a pixel never touches the multipliers
+ * of its CustomColors. Transforms are immutable and shared by everyone
+ * converting the same channels, see get().
+ */
+class ColorTransform {
+public:
+  typedef boost::shared_ptr<const ColorTransform> Ptr;
+
+  /** Contributions of one channel, indexed by sample value, then by ink */
+  struct Table {
+    int16_t cmyk[256][4];
+  };
+
+private:
+  /** The channels the transform was compiled from */
+  std::vector<CustomColor::Ptr> channels;
+
+  /**
+   * One table per channel. Each table spans a whole number of cache lines, so
+   * no table shares a line with its neighbours.
+   */
+  std::vector<Table, boost::alignment::aligned_allocator<Table, 64>> tables;
+
+private:
+  explicit ColorTransform(const std::vector<CustomColor::Ptr> &channels);
+
+public:
+  /**
+   * Returns the transform for @param channels, compiling it only if nobody
+   * holds one for these exact channels yet.
+   */
+  static Ptr get(const std::vector<CustomColor::Ptr> &channels);
+
+  /** Whether the transform was compiled from exactly @param channels */
+  bool matches(const std::vector<CustomColor::Ptr> &channels_) const {
+    return channels == channels_;
+  }
+
+  /** Number of channels (samples per pixel) the transform converts */
+  size_t getSpp() const { return tables.size(); }
+
+  /**
+   * Adds the contributions of the samples of one pixel, starting at
+   * @param samples, to the C, M, Y and K values in @param cmyk
+   */
+  void addPixel(const uint8_t *samples, int32_t cmyk[4]) const {
+    for (size_t j = 0; j < tables.size(); j++) {
+      const int16_t *entry = tables[j].cmyk[samples[j]];
+      cmyk[0] += entry[0];
+      cmyk[1] += entry[1];
+      cmyk[2] += entry[2];
+      cmyk[3] += entry[3];
+    }
+  }
+
+  /**
+   * Adds @param count pixels of @param samples onto the CMYK pixels at
+   * @param surface, clipping every ink to [0, 255]
+   */
+  void apply(const uint8_t *samples, uint8_t *surface, size_t count) const;
+
+  /**
+   * Converts @param count pixels of @param samples to opaque ARGB32 pixels
+   * at @param target
+   */
+  void toArgb(const uint8_t *samples, uint32_t *target, size_t count) const;
+
+  /** Clips @param value to [0, 255] */
+  static uint8_t clip(int32_t value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+  }
+};
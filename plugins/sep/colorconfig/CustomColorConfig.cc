@@ -2,33 +2,97 @@
 // Created by developer on 01-06-21.
 //
 #include "CustomColorConfig.hh"
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <cctype>
+#include <gio/gio.h>
 #include <iostream>
 #include <list>
 #include <unordered_set>
 
 namespace pt = boost::property_tree;
 
-ColorConfig::ColorConfig() {}
+namespace {
+void coloursFileChanged(GFileMonitor *, GFile *, GFile *,
+                        GFileMonitorEvent event, gpointer path) {
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event == G_FILE_MONITOR_EVENT_CREATED ||
+      event == G_FILE_MONITOR_EVENT_DELETED) {
+    ColorConfig::getInstance().loadFile(static_cast<const char *>(path));
+  }
+}
+} // namespace
 
-void ColorConfig::loadFile(std::string file) {
-  colors.clear();
-  pt::ptree root;
+size_t ColorTable::CaseInsensitiveHash::operator()(const std::string &s) const {
+  // 64-bit FNV-1a over the upper case characters
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : s) {
+    hash ^= std::toupper(static_cast<unsigned char>(c));
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<size_t>(hash);
+}
+
+bool ColorTable::CaseInsensitiveEqual::operator()(const std::string &a,
+                                                  const std::string &b) const {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::toupper(static_cast<unsigned char>(x)) ==
+                  std::toupper(static_cast<unsigned char>(y));
+         });
+}
+
+void ColorTable::addColor(const CustomColor::Ptr &color) {
+  colors.push_back(color);
+  // emplace() keeps the earlier color when a name or alias is taken
+  index.emplace(color->name, color);
+  for (auto const &alias : color->aliases)
+    index.emplace(alias, color);
+}
+
+CustomColor::Ptr ColorTable::find(const std::string &name) const {
+  auto it = index.find(name);
+  return it == index.end() ? nullptr : it->second;
+}
+
+bool ColorTable::sameColors(const ColorTable &other) const {
+  return std::equal(
+      colors.begin(), colors.end(), other.colors.begin(), other.colors.end(),
+      [](const CustomColor::Ptr &a, const CustomColor::Ptr &b) {
+        return a->name == b->name && a->aliases == b->aliases &&
+               a->cMultiplier == b->cMultiplier &&
+               a->mMultiplier == b->mMultiplier &&
+               a->yMultiplier == b->yMultiplier &&
+               a->kMultiplier == b->kMultiplier;
+      });
+}
+
+ColorConfig::ColorConfig() : table(boost::make_shared<ColorTable>()) {}
+
+boost::filesystem::path ColorConfig::resolvePath(const std::string &file) {
   boost::filesystem::path full_path(boost::filesystem::current_path());
   if (file == "colours.json") {
     full_path.append(file);
   } else {
     full_path = file;
   }
+  return full_path;
+}
+
+void ColorConfig::loadFile(std::string file) {
+  ColorTable::Ptr colors = boost::make_shared<ColorTable>();
+  pt::ptree root;
+  boost::filesystem::path full_path = resolvePath(file);
   if (!boost::filesystem::exists(
           full_path)) { // File does not exist on file system
     std::cout << "WARNING: Colours file does not exist at path: " +
                      full_path.string() + "\n";
     std::cout << "Loading default CMYK \n";
-    addNonExistentDefaultColors();
+    addNonExistentDefaultColors(*colors);
+    publish(colors);
     return;
   }
 
@@ -39,7 +103,8 @@ void ColorConfig::loadFile(std::string file) {
     std::cout << "WARNING: Loading colours file failed. file at: " +
                      full_path.string() + " is most likely ill formed.\n";
     std::cout << "Loading default CMYK \n";
-    addNonExistentDefaultColors();
+    addNonExistentDefaultColors(*colors);
+    publish(colors);
     return;
   }
 
@@ -49,72 +114,128 @@ void ColorConfig::loadFile(std::string file) {
   std::cout << "Loading colour config file. NOTE: v is reserved for varnish, "
                "so should not be defined as name or alias!!\n";
   for (pt::ptree::value_type &v : root.get_child("colours")) {
-    parseColor(v, seenNamesAndAliases);
+    parseColor(v, seenNamesAndAliases, *colors);
   }
-  addNonExistentDefaultColors();
+  addNonExistentDefaultColors(*colors);
+  publish(colors);
+}
+
+void ColorConfig::watchFile(std::string file) {
+  boost::filesystem::path full_path = resolvePath(file);
+  {
+    boost::mutex::scoped_lock lock(mtx);
+    if (monitor && watchedPath == full_path)
+      return; // Kept up to date already
+  }
+
+  loadFile(full_path.string());
+
+  boost::mutex::scoped_lock lock(mtx);
+  if (monitor) {
+    g_file_monitor_cancel(G_FILE_MONITOR(monitor));
+    g_object_unref(monitor);
+  }
+  watchedPath = full_path;
+  GFile *gfile = g_file_new_for_path(watchedPath.c_str());
+  monitor = g_file_monitor_file(gfile, G_FILE_MONITOR_NONE, nullptr, nullptr);
+  g_object_unref(gfile);
+  if (monitor) {
+    // The path outlives the monitor, it is only replaced after cancelling it
+    g_signal_connect(monitor, "changed", G_CALLBACK(coloursFileChanged),
+                     const_cast<char *>(watchedPath.c_str()));
+  }
+}
+
+void ColorConfig::publish(const ColorTable::Ptr &newTable) {
+  std::vector<Listener> toNotify;
+  {
+    boost::mutex::scoped_lock lock(mtx);
+    if (newTable->sameColors(*table))
+      return;
+    newTable->version = table->version + 1;
+    table = newTable;
+    for (auto &listener : listeners)
+      toNotify.push_back(listener.second);
+  }
+
+  for (auto &listener : toNotify)
+    listener(newTable);
+}
+
+ColorTable::ConstPtr ColorConfig::getColors() {
+  boost::mutex::scoped_lock lock(mtx);
+  return table;
+}
+
+unsigned int ColorConfig::addListener(Listener listener) {
+  boost::mutex::scoped_lock lock(mtx);
+  listeners[nextListener] = std::move(listener);
+  return nextListener++;
+}
+
+void ColorConfig::removeListener(unsigned int id) {
+  boost::mutex::scoped_lock lock(mtx);
+  listeners.erase(id);
+}
+
+void ColorConfig::addColor(const CustomColor::Ptr &color) {
+  ColorTable::Ptr colors = boost::make_shared<ColorTable>(*getColors());
+  colors->addColor(color);
+  publish(colors);
 }
 
 void ColorConfig::addNonExistentDefaultColors() {
+  ColorTable::Ptr colors = boost::make_shared<ColorTable>(*getColors());
+  addNonExistentDefaultColors(*colors);
+  publish(colors);
+}
+
+void ColorConfig::addNonExistentDefaultColors(ColorTable &colors) {
 
   // If no cyan configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("c")) {
+  if (!colors.find("c")) {
     CustomColor::Ptr newColour =
         boost::make_shared<CustomColor>("C", 1, 0, 0, 0);
 
-    colors.push_back(newColour);
+    colors.addColor(newColour);
   }
 
   // If no magenta configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("m")) {
+  if (!colors.find("m")) {
     CustomColor::Ptr newColour =
         boost::make_shared<CustomColor>("M", 0, 1, 0, 0);
 
-    colors.push_back(newColour);
+    colors.addColor(newColour);
   }
 
   // If no yellow configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("y")) {
+  if (!colors.find("y")) {
     CustomColor::Ptr newColour =
         boost::make_shared<CustomColor>("Y", 0, 0, 1, 0);
 
-    colors.push_back(newColour);
+    colors.addColor(newColour);
   }
 
   // If no key configuration exists, add the default configuration
-  if (!getColorByNameOrAlias("k")) {
+  if (!colors.find("k")) {
     CustomColor::Ptr newColour =
         boost::make_shared<CustomColor>("K", 0, 0, 0, 1);
 
-    colors.push_back(newColour);
+    colors.addColor(newColour);
   }
 }
 
-CustomColor::Ptr ColorConfig::getColorByNameOrAlias(std::string name) {
-  boost::algorithm::to_upper(name);
-  auto definedColors = getDefinedColors();
-  std::string lowerName;
-  std::string lowerAlias;
-  for (auto &color : definedColors) {
-    lowerName = boost::algorithm::to_upper_copy(color->name);
-    if (lowerName == name) {
-      return color;
-    }
-
-    for (auto const &alias : color->aliases) {
-      lowerAlias = boost::algorithm::to_upper_copy(alias);
-      if (lowerAlias == name) {
-        return color;
-      }
-    }
-  }
-  return nullptr;
+CustomColor::Ptr ColorConfig::getColorByNameOrAlias(const std::string &name) {
+  return getColors()->find(name);
 }
 
-std::vector<CustomColor::Ptr> ColorConfig::getDefinedColors() { return colors; }
+std::vector<CustomColor::Ptr> ColorConfig::getDefinedColors() {
+  return getColors()->colors;
+}
 
 void ColorConfig::parseColor(
     pt::ptree::value_type &v,
-    std::unordered_set<std::string> &seenNamesAndAliases) {
+    std::unordered_set<std::string> &seenNamesAndAliases, ColorTable &colors) {
   auto name = v.second.get<std::string>("name");
   boost::algorithm::to_upper(name); // Convert the name to uppercase
 
@@ -172,5 +293,5 @@ void ColorConfig::parseColor(
     std::cout << "No aliasses found.\n";
   }
 
-  colors.push_back(newColour);
+  colors.addColor(newColour);
 }
\ No newline at end of file
@@ -5,22 +5,89 @@
 #pragma once
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <iostream>
+#include <map>
 
 #include "CustomColor.hh"
 #include <scroom/plugininformationinterface.hh>
 #include <scroom/utilities.hh>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace pt = boost::property_tree;
+
+struct _GFileMonitor;
+
+/**
+ * An immutable snapshot of the configured colors. Loading the colours file
+ * publishes a new table rather than changing the current one, so the colors
+ * of a table can be read without locking.
+ */
+class ColorTable {
+public:
+  typedef boost::shared_ptr<ColorTable> Ptr;
+  typedef boost::shared_ptr<const ColorTable> ConstPtr;
+
+private:
+  /** Hashes strings regardless of case */
+  struct CaseInsensitiveHash {
+    size_t operator()(const std::string &s) const;
+  };
+
+  /** Compares strings regardless of case */
+  struct CaseInsensitiveEqual {
+    bool operator()(const std::string &a, const std::string &b) const;
+  };
+
+public:
+  /** Increases with every table published that differs from the last */
+  unsigned int version = 0;
+
+  std::vector<CustomColor::Ptr> colors;
+
+  /**
+   * The colors by name and alias, regardless of case. If several colors
+   * share a name or alias, the first one defined is used.
+   */
+  std::unordered_map<std::string, CustomColor::Ptr, CaseInsensitiveHash,
+                     CaseInsensitiveEqual>
+      index;
+
+  /** Adds @param color to the colors and the index */
+  void addColor(const CustomColor::Ptr &color);
+
+  /** Returns the color named or aliased @param name, or nullptr */
+  CustomColor::Ptr find(const std::string &name) const;
+
+  /** Whether @param other defines the same colors, in the same order */
+  bool sameColors(const ColorTable &other) const;
+};
+
 class ColorConfig {
+public:
+  /** Called with the new table whenever the colors change */
+  typedef boost::function<void(ColorTable::ConstPtr)> Listener;
 
 private:
   ColorConfig();
 
 private:
-  std::vector<CustomColor::Ptr> colors;
+  /** The current colors */
+  ColorTable::ConstPtr table;
+
+  /** Protects table, listeners and the file watching */
+  boost::mutex mtx;
+
+  std::map<unsigned int, Listener> listeners;
+  unsigned int nextListener = 0;
+
+  /** The colours file being watched for changes, if any */
+  boost::filesystem::path watchedPath;
+  _GFileMonitor *monitor = nullptr;
 
 public:
   static ColorConfig &getInstance() {
@@ -28,13 +95,47 @@ public:
     return INSTANCE;
   }
 
+  /** Returns the current colors. The table never changes afterwards. */
+  ColorTable::ConstPtr getColors();
+
   std::vector<CustomColor::Ptr> getDefinedColors();
-  CustomColor::Ptr getColorByNameOrAlias(std::string name);
+  CustomColor::Ptr getColorByNameOrAlias(const std::string &name);
   void loadFile(std::string file = "colours.json");
 
+  /**
+   * Loads @param file, unless it is loaded already, and reloads it whenever
+   * it changes on disk. Needs a running GLib main loop.
+   */
+  void watchFile(std::string file = "colours.json");
+
   void addNonExistentDefaultColors();
 
+  /**
+   * Registers @param listener to be called after the colors changed.
+   * @return an id for removeListener()
+   */
+  unsigned int addListener(Listener listener);
+
+  /** Unregisters the listener with id @param id */
+  void removeListener(unsigned int id);
+
 private:
-  void parseColor(pt::ptree::value_type &v,
-                  std::unordered_set<std::string> &seenNamesAndAliases);
+  /** Returns the path of the colours file named @param file */
+  static boost::filesystem::path resolvePath(const std::string &file);
+
+  /**
+   * Makes @param newTable the current table and notifies the listeners, if
+   * it differs from the current one.
+   */
+  void publish(const ColorTable::Ptr &newTable);
+
+  /** Publishes a copy of the current table with @param color added */
+  void addColor(const CustomColor::Ptr &color);
+
+  static void addNonExistentDefaultColors(ColorTable &colors);
+
+  static void
+  parseColor(pt::ptree::value_type &v,
+             std::unordered_set<std::string> &seenNamesAndAliases,
+             ColorTable &colors);
 };
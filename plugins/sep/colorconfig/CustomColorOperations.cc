@@ -3,7 +3,6 @@
 //
 
 #include "CustomColorOperations.hh"
-#include "CustomColorHelpers.hh"
 #include <iostream>
 #include <scroom/bitmap-helpers.hh>
 #include <utility>
@@ -37,6 +36,13 @@ PipetteCommonOperationsCustomColor::sumPixelValues(
     si += stride;
   }
 
+  return toPipetteColor(sums);
+}
+
+PipetteLayerOperations::PipetteColor
+PipetteCommonOperationsCustomColor::toPipetteColor(
+    const std::vector<size_t> &sums) {
+  const std::vector<CustomColor::Ptr> colors = getColors();
   // Copy map to vector of pairs
   PipetteColor result = {};
   // Map different aliasses of the same color to the same pipette color
@@ -79,31 +85,13 @@ Scroom::Utils::Stuff OperationsCustomColors::cache(const ConstTile::Ptr tile) {
   // Cur is a pointer to the start of the row in the tile (source)
   const uint8_t *cur = tile->data.get();
 
-  for (int i = 0; i < spp * tile->height * tile->width; i += spp) {
-    // Convert custom colors to CMYK and then to ARGB, because cairo doesn't
-    // know how to render CMYK.
-    int16_t C = 0;
-    int16_t M = 0;
-    int16_t Y = 0;
-    int16_t K = 0;
-    for (uint16_t j = 0; j < spp; j++) {
-      auto &color = colors[j];
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, cur[i + j]);
-    }
-
-    uint8_t C_i = 255 - CustomColorHelpers::toUint8(C);
-    uint8_t M_i = 255 - CustomColorHelpers::toUint8(M);
-    uint8_t Y_i = 255 - CustomColorHelpers::toUint8(Y);
-    uint8_t K_i = 255 - CustomColorHelpers::toUint8(K);
-
-    uint8_t R = (C_i * K_i) / 255;
-    uint8_t G = (M_i * K_i) / 255;
-    uint8_t B = (Y_i * K_i) / 255;
-
-    // Write 255 as alpha (fully opaque)
-    uint32_t target = i * 4 / spp; // Scale the target to the 4 channel target
-                                   // row, from the n channel source row
-    row[target / 4] = 255u << 24 | R << 16 | G << 8 | B;
+  // Convert custom colors to CMYK and then to ARGB, because cairo doesn't
+  // know how to render CMYK.
+  ColorTransform::Ptr colors = getTransform();
+  for (int y = 0; y < tile->height; y++) {
+    colors->toArgb(cur, row, tile->width);
+    cur += spp * tile->width;
+    row += stride / 4;
   }
   return Scroom::Bitmap::BitmapSurface::create(
       tile->width, tile->height, CAIRO_FORMAT_ARGB32, stride, data);
@@ -162,5 +150,19 @@ int OperationsCustomColors::getBpp() { return spp * bps; }
 
 void PipetteCommonOperationsCustomColor::setColors(
     std::vector<CustomColor::Ptr> colors_) {
+  // Compile outside of the lock, so tiles can still be converted meanwhile
+  ColorTransform::Ptr transform_ = ColorTransform::get(colors_);
+  boost::mutex::scoped_lock lock(colorsMtx);
   colors = std::move(colors_);
+  transform = transform_;
+}
+
+std::vector<CustomColor::Ptr> PipetteCommonOperationsCustomColor::getColors() {
+  boost::mutex::scoped_lock lock(colorsMtx);
+  return colors;
+}
+
+ColorTransform::Ptr PipetteCommonOperationsCustomColor::getTransform() {
+  boost::mutex::scoped_lock lock(colorsMtx);
+  return transform;
 }
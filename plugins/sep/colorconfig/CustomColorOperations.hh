@@ -4,8 +4,10 @@
 
 #pragma once
 
+#include "ColorTransform.hh"
 #include "CustomColor.hh"
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scroom/layeroperations.hh>
 #include <scroom/pipettelayeroperations.hh>
 
@@ -16,6 +18,15 @@ protected:
   uint16_t spp;
   std::vector<CustomColor::Ptr> colors;
 
+  /** The colors compiled for converting tiles. Replaced along with colors. */
+  ColorTransform::Ptr transform;
+
+  /**
+   * Protects colors and transform, as they can be replaced while tiles are
+   * converted
+   */
+  boost::mutex colorsMtx;
+
 public:
   using Ptr = boost::shared_ptr<PipetteCommonOperationsCustomColor>;
 
@@ -25,9 +36,23 @@ public:
   };
 
   void setColors(std::vector<CustomColor::Ptr> colors_);
+
+  /** Returns a copy of the colors, which setColors() can't change */
+  std::vector<CustomColor::Ptr> getColors();
+
+  /** Returns the transform compiled from the current colors */
+  ColorTransform::Ptr getTransform();
+
   PipetteLayerOperations::PipetteColor
   sumPixelValues(Scroom::Utils::Rectangle<int> area,
                  const ConstTile::Ptr tile) override;
+
+  /**
+   * Converts the sums of the samples of every channel to pipette colors,
+   * adding up channels that are aliases of the same color.
+   */
+  PipetteLayerOperations::PipetteColor
+  toPipetteColor(const std::vector<size_t> &sums);
 };
 
 class OperationsCustomColors : public PipetteCommonOperationsCustomColor {
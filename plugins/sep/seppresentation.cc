@@ -1,7 +1,12 @@
 #include "seppresentation.hh"
 
+#include <algorithm>
+#include <atomic>
+
+#include <boost/thread.hpp>
 #include <scroom/cairo-helpers.hh>
 #include <scroom/layeroperations.hh>
+#include <scroom/threadpool.hh>
 #include <scroom/tiledbitmaplayer.hh>
 #include <string>
 
@@ -16,14 +21,25 @@ SepPresentation::SepPresentation() : sep_source(SepSource::create()) {
   properties[PIPETTE_PROPERTY_NAME] = ""; // add support for pipette
 }
 
-SepPresentation::~SepPresentation() {}
+SepPresentation::~SepPresentation() {
+  ColorConfig::getInstance().removeListener(color_listener);
+}
 
 SepPresentation::Ptr SepPresentation::create() {
-  return Ptr(new SepPresentation());
+  Ptr result = Ptr(new SepPresentation());
+
+  // Recolor when the colours file changes
+  boost::weak_ptr<SepPresentation> weak = result;
+  result->color_listener = ColorConfig::getInstance().addListener(
+      [weak](ColorTable::ConstPtr colors) {
+        if (Ptr presentation = weak.lock())
+          presentation->colorsChanged(colors);
+      });
+  return result;
 }
 
 bool SepPresentation::load(const std::string &fileName) {
-  ColorConfig::getInstance().loadFile();
+  ColorConfig::getInstance().watchFile();
   const SepFile file_content = SepSource::parseSep(fileName);
   this->file_name = fileName;
 
@@ -45,12 +61,16 @@ bool SepPresentation::load(const std::string &fileName) {
   layer_operations = OperationsCustomColors::create(sep_source->getSpp());
 
   // Set the colors relevant to this tiledbitmap
+  ColorTable::ConstPtr colors = ColorConfig::getInstance().getColors();
   std::vector<CustomColor::Ptr> bitmapColors = {};
   for (auto color : sep_source->getChannels()) {
-    bitmapColors.push_back(
-        ColorConfig::getInstance().getColorByNameOrAlias(color));
+    bitmapColors.push_back(colors->find(color));
+  }
+  {
+    boost::mutex::scoped_lock lock(colorsMtx);
+    layer_operations->setColors(bitmapColors);
+    appliedColors = colors->version;
   }
-  layer_operations->setColors(bitmapColors);
   tbi = createTiledBitmap(width, height, {layer_operations});
   tbi->setSource(sep_source);
 
@@ -59,9 +79,49 @@ bool SepPresentation::load(const std::string &fileName) {
 
 TransformationData::Ptr SepPresentation::getTransform() { return transform; }
 
+void SepPresentation::colorsChanged(const ColorTable::ConstPtr &colors) {
+  // Listeners run on the main loop, which holds the GDK lock recolor() takes
+  CpuBound()->schedule(boost::bind(&SepPresentation::recolor,
+                                   shared_from_this<SepPresentation>(), colors),
+                       PRIO_HIGHER);
+}
+
+void SepPresentation::recolor(const ColorTable::ConstPtr &colors) {
+  if (!tbi)
+    return;
+
+  boost::mutex::scoped_lock lock(colorsMtx);
+  if (colors->version <= appliedColors)
+    return; // Already applied, or superseded by a newer table
+  appliedColors = colors->version;
+
+  // Colors that are no longer defined keep their old definition
+  std::vector<CustomColor::Ptr> bitmapColors = layer_operations->getColors();
+  std::vector<std::string> channels = sep_source->getChannels();
+  for (size_t i = 0; i < channels.size() && i < bitmapColors.size(); i++) {
+    CustomColor::Ptr color = colors->find(channels[i]);
+    if (color)
+      bitmapColors[i] = color;
+  }
+  layer_operations->setColors(bitmapColors);
+
+  // Reopening the views drops the tiles they converted with the old colors
+  // The views only change on the UI thread, so they stay open while this
+  // holds the GDK lock
+  gdk_threads_enter();
+  for (const ViewInterface::WeakPtr &view : getViews()) {
+    tbi->close(view);
+    tbi->open(view);
+  }
+  gdk_threads_leave();
+  triggerRedraw();
+}
+
 void SepPresentation::triggerRedraw() {
-  for (ViewInterface::WeakPtr view : views) {
+  for (const ViewInterface::WeakPtr &view : getViews()) {
     ViewInterface::Ptr viewPtr = view.lock();
+    if (!viewPtr)
+      continue;
     gdk_threads_enter();
     viewPtr->invalidate();
     gdk_threads_leave();
@@ -119,6 +179,7 @@ void SepPresentation::viewAdded(ViewInterface::WeakPtr interface) {
     return;
   }
 
+  boost::mutex::scoped_lock lock(viewsMtx);
   if (views.empty() && sep_source->varnish != nullptr) {
     sep_source->varnish->setView(interface);
     sep_source->varnish->triggerRedraw = boost::bind(
@@ -126,11 +187,13 @@ void SepPresentation::viewAdded(ViewInterface::WeakPtr interface) {
   }
 
   views.insert(interface);
+  lock.unlock();
 
   tbi->open(interface);
 }
 
 void SepPresentation::viewRemoved(ViewInterface::WeakPtr interface) {
+  boost::mutex::scoped_lock lock(viewsMtx);
   views.erase(interface);
 
   if (tbi == nullptr) {
@@ -143,15 +206,79 @@ void SepPresentation::viewRemoved(ViewInterface::WeakPtr interface) {
       interface.lock() == sep_source->varnish->viewWeak.lock()) {
     sep_source->varnish->resetView(*views.begin());
   }
+  lock.unlock();
 
   tbi->close(interface);
 }
 
-std::set<ViewInterface::WeakPtr> SepPresentation::getViews() { return views; }
+std::set<ViewInterface::WeakPtr> SepPresentation::getViews() {
+  boost::mutex::scoped_lock lock(viewsMtx);
+  return views;
+}
 
 ////////////////////////////////////////////////////////////////////////
 // PipetteViewInterface
 
+namespace {
+/** The tiles under a pipette selection that need to be loaded and summed */
+struct PipetteJobs {
+  typedef boost::shared_ptr<PipetteJobs> Ptr;
+
+  /** Tile position, and the part of the tile to sum (in tile pixels) */
+  typedef std::pair<Scroom::Utils::Point<int>, Scroom::Utils::Rectangle<int>>
+      Job;
+
+  PipetteCommonOperationsCustomColor::Ptr operations;
+
+  std::vector<Job> tiles;
+
+  /** The tiles that were loaded already, in the order of tiles */
+  std::vector<ConstTile::Ptr> loaded;
+
+  /** Whether a thread took on summing each tile, in the order of tiles */
+  std::vector<bool> claimed;
+
+  /** The sums, in the order of tiles */
+  std::vector<PipetteLayerOperations::PipetteColor> sums;
+
+  /** Index of the next loaded tile to be claimed by a worker */
+  std::atomic<size_t> next{0};
+
+  boost::mutex mtx;
+  boost::condition_variable finished;
+  size_t nFinished = 0;
+
+  /** Sums tile @param i, loaded as @param tile, unless that happened already */
+  void sum(size_t i, const ConstTile::Ptr &tile) {
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      if (claimed[i])
+        return;
+      claimed[i] = true;
+    }
+
+    sums[i] = operations->sumPixelValues(tiles[i].second, tile);
+
+    boost::mutex::scoped_lock lock(mtx);
+    if (++nFinished == tiles.size())
+      finished.notify_all();
+  }
+};
+
+/** Sums a tile under a pipette selection as soon as it has been loaded */
+class PipetteTileObserver : public TileInternalObserver {
+private:
+  PipetteJobs::Ptr jobs;
+  size_t index;
+
+public:
+  PipetteTileObserver(PipetteJobs::Ptr jobs_, size_t index_)
+      : jobs(std::move(jobs_)), index(index_) {}
+
+  void tileLoaded(ConstTile::Ptr tile) override { jobs->sum(index, tile); }
+};
+} // namespace
+
 PipetteLayerOperations::PipetteColor
 SepPresentation::getPixelAverages(Scroom::Utils::Rectangle<int> area) {
   Scroom::Utils::Rectangle<int> presentationArea = getRect().toIntRectangle();
@@ -173,20 +300,78 @@ SepPresentation::getPixelAverages(Scroom::Utils::Rectangle<int> area) {
   int tile_pos_x_end = (area.getRight() - 1) / TILESIZE;
   int tile_pos_y_end = (area.getBottom() - 1) / TILESIZE;
 
+  PipetteJobs::Ptr jobs = boost::make_shared<PipetteJobs>();
+  jobs->operations = layer_operations;
+  std::vector<size_t> tile_sums;
   for (int x = tile_pos_x_start; x <= tile_pos_x_end; x++) {
     for (int y = tile_pos_y_start; y <= tile_pos_y_end; y++) {
-      ConstTile::Ptr tile = bottomLayer->getTile(x, y)->getConstTileSync();
-      Scroom::Utils::Rectangle<int> tile_rectangle(0, 0, tile->width,
-                                                   tile->height);
       Scroom::Utils::Point<int> base(x * TILESIZE, y * TILESIZE);
+      Scroom::Utils::Rectangle<int> tile_rectangle(
+          0, 0, std::min<int>(TILESIZE, width - base.x),
+          std::min<int>(TILESIZE, height - base.y));
 
       Scroom::Utils::Rectangle<int> inter_rect =
           tile_rectangle.intersection(area - base);
 
-      pipetteColors = sumPipetteColors(
-          pipetteColors, layer_operations->sumPixelValues(inter_rect, tile));
+      // Tiles that are covered completely don't need to be loaded if their
+      // sums were recorded when they were filled.
+      if (inter_rect.getWidth() == tile_rectangle.getWidth() &&
+          inter_rect.getHeight() == tile_rectangle.getHeight() &&
+          sep_source->getTileSums(x, y, tile_sums)) {
+        pipetteColors = sumPipetteColors(
+            pipetteColors, layer_operations->toPipetteColor(tile_sums));
+        continue;
+      }
+
+      jobs->tiles.emplace_back(Scroom::Utils::Point<int>(x, y), inter_rect);
+    }
+  }
+  jobs->loaded.resize(jobs->tiles.size());
+  jobs->claimed.resize(jobs->tiles.size());
+  jobs->sums.resize(jobs->tiles.size());
+
+  // Start loading all missing tiles at once. Each one is summed by the thread
+  // that loaded it, as soon as it arrives. Observing the tile before asking
+  // for it again catches the loads that finish in between.
+  std::vector<TileInternalObserver::Ptr> observers;
+  std::vector<Scroom::Utils::Stuff> registrations;
+  size_t nLoaded = 0;
+  for (size_t i = 0; i < jobs->tiles.size(); i++) {
+    const Scroom::Utils::Point<int> &position = jobs->tiles[i].first;
+    TileInternal::Ptr tile = bottomLayer->getTile(position.x, position.y);
+    jobs->loaded[i] = tile->getConstTileAsync();
+    if (!jobs->loaded[i]) {
+      observers.push_back(boost::make_shared<PipetteTileObserver>(jobs, i));
+      registrations.push_back(tile->registerObserver(observers.back()));
+      jobs->loaded[i] = tile->getConstTileAsync();
     }
+    if (jobs->loaded[i])
+      nLoaded++;
   }
 
+  // Sum the loaded tiles in parallel. Tile loads are thread pool work as
+  // well, so the helpers never wait for one.
+  auto work = [jobs]() {
+    for (size_t i = jobs->next++; i < jobs->tiles.size(); i = jobs->next++) {
+      if (jobs->loaded[i])
+        jobs->sum(i, jobs->loaded[i]);
+    }
+  };
+
+  unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+  size_t nHelpers = std::min<size_t>(nLoaded, nThreads - 1);
+  for (size_t i = 0; i < nHelpers; i++)
+    CpuBound()->schedule(work, PRIO_HIGHER);
+  work();
+
+  {
+    boost::mutex::scoped_lock lock(jobs->mtx);
+    while (jobs->nFinished < jobs->tiles.size())
+      jobs->finished.wait(lock);
+  }
+
+  for (const auto &sums : jobs->sums)
+    pipetteColors = sumPipetteColors(pipetteColors, sums);
+
   return dividePipetteColors(pipetteColors, totalPixels);
 }
@@ -3,9 +3,12 @@
 #include <map>
 #include <string>
 
+#include <boost/thread/mutex.hpp>
+
 #include <scroom/layeroperations.hh>
 #include <scroom/presentationinterface.hh>
 
+#include "colorconfig/CustomColorConfig.hh"
 #include "colorconfig/CustomColorOperations.hh"
 #include "sepsource.hh"
 
@@ -31,10 +34,25 @@ private:
 
   std::set<ViewInterface::WeakPtr> views;
 
+  /**
+   * Protects views. They change on the UI thread, but recolor() and
+   * triggerRedraw() walk them from worker threads.
+   */
+  boost::mutex viewsMtx;
+
   std::map<std::string, std::string> properties;
 
   PipetteCommonOperationsCustomColor::Ptr layer_operations;
 
+  /** Id of the listener for color changes */
+  unsigned int color_listener;
+
+  /** Version of the color table the channels were last colored with */
+  unsigned int appliedColors = 0;
+
+  /** Serializes recolor(), so tables are applied in the order published */
+  boost::mutex colorsMtx;
+
 private:
   /**
    * Constructor for a standalone SepPresentation to be passed to
@@ -64,6 +82,16 @@ public:
   /** Causes the SepPresentation to redraw the current presentation */
   void triggerRedraw();
 
+  /** Schedules recolor() with @param colors on a worker thread */
+  void colorsChanged(const ColorTable::ConstPtr &colors);
+
+  /**
+   * Switches the channels to the colors of the same name in @param colors.
+   * The tiles keep their samples, only the views convert them again.
+   * Does nothing if @param colors is no newer than the table applied last.
+   */
+  void recolor(const ColorTable::ConstPtr &colors);
+
   ////////////////////////////////////////////////////////////////////////
   // PresentationInterface
   ////////////////////////////////////////////////////////////////////////
@@ -211,10 +211,18 @@ void SepSource::fillSliLayerBitmap(SliLayer::Ptr sli) {
       nr_channels; // nr_channels bytes per pixel (8 bits per channel)
   sli->bitmap.reset(new uint8_t[sli->height * row_width]);
 
+  fillSliLayerRows(sli, 0, sli->height, sli->bitmap.get());
+}
+
+void SepSource::fillSliLayerRows(SliLayer::Ptr sli, int firstRow,
+                                 int rowCount, uint8_t *target) {
+  const int row_width = sli->width * nr_channels;
+
   auto temp = std::vector<byte>(row_width);
-  for (int y = 0; y < sli->height; y++) {
-    readCombinedScanline(temp, y);
-    memcpy(&sli->bitmap[y * row_width], temp.data(), row_width);
+  for (int y = 0; y < rowCount; y++) {
+    readCombinedScanline(temp, firstRow + y);
+    memcpy(target + static_cast<size_t>(y) * row_width, temp.data(),
+           row_width);
   }
 }
 
@@ -258,7 +266,7 @@ void SepSource::openFiles() {
     SliLayer::Ptr varnishLayer =
         SliLayer::create(sep_file.varnish_file.string(), "Varnish", 0, 0);
     if (varnishLayer->fillMetaFromTiff(8, 1)) {
-      varnishLayer->fillBitmapFromTiff();
+      // The bitmap isn't loaded, the varnish reads it in bands when drawn
       varnish = Varnish::create(varnishLayer);
     } else {
       show_warning = true;
@@ -349,9 +357,29 @@ void SepSource::fillTiles(int startLine, int line_count, int tileWidth,
   // into account).
   const byte *horizontal_offset = row.data() + first_tile * tile_stride;
 
+  // The pipette uses the channel sums of tiles that are filled in one go
+  const bool complete_tiles =
+      record_tile_sums && start_line % tileWidth == 0 &&
+      (line_count == tileWidth ||
+       start_line + line_count == sep_file.height);
+  std::vector<size_t> sums(complete_tiles ? tile_count * bpp : 0);
+
   for (size_t i = 0; i < static_cast<size_t>(line_count); i++) {
     readCombinedScanline(row, i + start_line);
 
+    if (complete_tiles) {
+      const byte *sample = horizontal_offset;
+      const byte *end = row.data() + row.size();
+      for (size_t tile = 0; tile < tile_count; tile++) {
+        size_t *tile_sum = sums.data() + tile * bpp;
+        const byte *tile_end = std::min(end, sample + tile_stride);
+        while (sample < tile_end) {
+          for (size_t c = 0; c < bpp; c++)
+            tile_sum[c] += *sample++;
+        }
+      }
+    }
+
     // The general case for completely filled tiles. The last tile
     // is the only tile that might not be completely filled, so that
     // case has a separate implementation below.
@@ -368,6 +396,25 @@ void SepSource::fillTiles(int startLine, int line_count, int tileWidth,
            remaining_width);
     tile_data[tile_count - 1] += tile_stride;
   }
+
+  if (complete_tiles) {
+    boost::mutex::scoped_lock lock(tile_sums_mtx);
+    const int tile_row = startLine / tileWidth;
+    for (size_t tile = 0; tile < tile_count; tile++) {
+      tile_sums[{static_cast<int>(first_tile + tile), tile_row}] =
+          std::vector<size_t>(sums.begin() + tile * bpp,
+                              sums.begin() + (tile + 1) * bpp);
+    }
+  }
+}
+
+bool SepSource::getTileSums(int x, int y, std::vector<size_t> &sums) {
+  boost::mutex::scoped_lock lock(tile_sums_mtx);
+  auto it = tile_sums.find({x, y});
+  if (it == tile_sums.end())
+    return false;
+  sums = it->second;
+  return true;
 }
 
 void SepSource::closeIfNeeded(struct tiff *&file) {
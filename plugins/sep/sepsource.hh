@@ -4,6 +4,7 @@
 #include <tiffio.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scroom/tiledbitmapinterface.hh>
 #include <scroom/transformpresentation.hh>
 
@@ -42,6 +43,15 @@ private:
   /** Name of this sep */
   std::string file_name;
 
+  /**
+   * The sum of every channel over each tile that has been filled
+   * completely, by tile column and row.
+   */
+  std::map<std::pair<int, int>, std::vector<size_t>> tile_sums;
+
+  /** Protects tile_sums, as tiles are filled on another thread */
+  boost::mutex tile_sums_mtx;
+
   /** Constructor */
   SepSource();
 
@@ -52,6 +62,15 @@ public:
   /** Pointer to varnish layer. */
   Varnish::Ptr varnish;
 
+  /**
+   * Whether fillTiles() records the sum of every channel over the tiles it
+   * fills, see getTileSums(). Lets the pipette measure the tiles a selection
+   * covers completely without loading them. Off by default: it adds a pass
+   * over every sample to each tile load, and the pipette loads the tiles it
+   * misses in parallel anyway.
+   */
+  bool record_tile_sums = false;
+
   /**
    * Create a pointer to SepSource using constructor and return it.
    */
@@ -84,6 +103,16 @@ public:
    */
   void fillSliLayerBitmap(SliLayer::Ptr sli);
 
+  /**
+   * Reads only rows [firstRow, firstRow + rowCount) of the SliLayer's bitmap.
+   * @param sli - pointer to SliLayer
+   * @param firstRow - the first row to read
+   * @param rowCount - the number of rows to read
+   * @param target - receives the rows, width * spp bytes per row
+   */
+  void fillSliLayerRows(SliLayer::Ptr sli, int firstRow, int rowCount,
+                        uint8_t *target);
+
   /**
    * Helper function to parseSep().
    * Given a file path, returns the parent directory.
@@ -162,6 +191,15 @@ public:
   void fillTiles(int startLine, int lineCount, int tileWidth, int firstTile,
                  std::vector<Tile::Ptr> &tiles) override;
 
+  /**
+   * Retrieves the sum of every channel over tile (@param x, @param y), as
+   * computed by fillTiles() when record_tile_sums is set.
+   * @param sums - receives one sum per channel.
+   * @return false if the tile hasn't been filled yet, or its sums weren't
+   * recorded.
+   */
+  bool getTileSums(int x, int y, std::vector<size_t> &sums);
+
   /**
    * Closes the TIFF files opened by `openFiles()`.
    */
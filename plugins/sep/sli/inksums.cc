@@ -0,0 +1,127 @@
+#include "inksums.hh"
+
+#include <algorithm>
+
+InkSums::InkSums(int width_, int height_)
+    : width(width_), height(height_),
+      columns((width_ + TILE_SIZE - 1) / TILE_SIZE),
+      rows((height_ + TILE_SIZE - 1) / TILE_SIZE),
+      tiles(static_cast<size_t>(columns) * rows),
+      table(static_cast<size_t>(columns + 1) * (rows + 1)) {}
+
+InkSums::Ptr InkSums::create(int width, int height) {
+  return Ptr(new InkSums(width, height));
+}
+
+void InkSums::addPixel(const uint8_t *pixel, Sum &sum) {
+  // transparent -> only the white background of Scroom remains visible
+  if (pixel[3] == 0)
+    return;
+
+  int c = 255 - pixel[2];
+  int m = 255 - pixel[1];
+  int y = 255 - pixel[0];
+  int k = std::min({c, m, y});
+  sum[0] += c - k;
+  sum[1] += m - k;
+  sum[2] += y - k;
+  sum[3] += k;
+}
+
+void InkSums::addPixels(const uint8_t *argb, int stride,
+                        Scroom::Utils::Rectangle<int> area, Sum &sum) {
+  for (int y = area.getTop(); y < area.getBottom(); y++) {
+    const uint8_t *pixel = argb + static_cast<size_t>(y) * stride +
+                           static_cast<size_t>(area.getLeft()) * 4;
+    for (int x = area.getLeft(); x < area.getRight(); x++, pixel += 4)
+      addPixel(pixel, sum);
+  }
+}
+
+void InkSums::update(const uint8_t *argb, int stride,
+                     Scroom::Utils::Rectangle<int> area) {
+  area = area.intersection({0, 0, width, height});
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return;
+
+  boost::mutex::scoped_lock lock(mtx);
+  for (int y = area.getTop() / TILE_SIZE;
+       y <= (area.getBottom() - 1) / TILE_SIZE; y++) {
+    for (int x = area.getLeft() / TILE_SIZE;
+         x <= (area.getRight() - 1) / TILE_SIZE; x++) {
+      Sum &sum = tiles[y * columns + x];
+      sum = {};
+      Scroom::Utils::Rectangle<int> tile{x * TILE_SIZE, y * TILE_SIZE,
+                                         TILE_SIZE, TILE_SIZE};
+      addPixels(argb, stride, tile.intersection({0, 0, width, height}), sum);
+    }
+  }
+  dirty = true;
+}
+
+InkSums::Sum InkSums::getSum(const uint8_t *argb, int stride,
+                             Scroom::Utils::Rectangle<int> area) {
+  Sum sum = {};
+  area = area.intersection({0, 0, width, height});
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return sum;
+
+  boost::mutex::scoped_lock lock(mtx);
+  if (dirty) {
+    for (int y = 0; y < rows; y++) {
+      for (int x = 0; x < columns; x++) {
+        const Sum &tile = tiles[y * columns + x];
+        const Sum &above = table[y * (columns + 1) + x + 1];
+        const Sum &left = table[(y + 1) * (columns + 1) + x];
+        const Sum &both = table[y * (columns + 1) + x];
+        Sum &entry = table[(y + 1) * (columns + 1) + x + 1];
+        for (int i = 0; i < 4; i++)
+          entry[i] = tile[i] + above[i] + left[i] - both[i];
+      }
+    }
+    dirty = false;
+  }
+
+  // The tiles entirely inside the area. Tiles at the edge of the surface
+  // count as whole.
+  int left = (area.getLeft() + TILE_SIZE - 1) / TILE_SIZE;
+  int top = (area.getTop() + TILE_SIZE - 1) / TILE_SIZE;
+  int right = area.getRight() == width ? columns : area.getRight() / TILE_SIZE;
+  int bottom = area.getBottom() == height ? rows : area.getBottom() / TILE_SIZE;
+  if (left >= right || top >= bottom) {
+    addPixels(argb, stride, area, sum);
+    return sum;
+  }
+
+  auto entry = [this](int x, int y) -> const Sum & {
+    return table[y * (columns + 1) + x];
+  };
+  for (int i = 0; i < 4; i++) {
+    sum[i] = entry(right, bottom)[i] - entry(left, bottom)[i] -
+             entry(right, top)[i] + entry(left, top)[i];
+  }
+
+  // The pixels around them
+  Scroom::Utils::Rectangle<int> inner =
+      Scroom::Utils::Rectangle<int>{left * TILE_SIZE, top * TILE_SIZE,
+                                    (right - left) * TILE_SIZE,
+                                    (bottom - top) * TILE_SIZE}
+          .intersection(area);
+  addPixels(argb, stride,
+            {area.getLeft(), area.getTop(), area.getWidth(),
+             inner.getTop() - area.getTop()},
+            sum);
+  addPixels(argb, stride,
+            {area.getLeft(), inner.getBottom(), area.getWidth(),
+             area.getBottom() - inner.getBottom()},
+            sum);
+  addPixels(argb, stride,
+            {area.getLeft(), inner.getTop(), inner.getLeft() - area.getLeft(),
+             inner.getHeight()},
+            sum);
+  addPixels(argb, stride,
+            {inner.getRight(), inner.getTop(),
+             area.getRight() - inner.getRight(), inner.getHeight()},
+            sum);
+  return sum;
+}
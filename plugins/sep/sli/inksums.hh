@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <scroom/rectangle.hh>
+
+/**
+ * Sums of the ink values of the bottom surface of an SLI file, so that the
+ * pipette can average large areas without visiting all of their pixels.
+ *
+ * The ink values are derived from the RGB values of the pixels, in the same
+ * way the pipette always did. They are summed per tile of TILE_SIZE by
+ * TILE_SIZE pixels, and the tile sums are kept in a summed-area table. An
+ * area is then summed from four entries of the table, plus the pixels along
+ * its edges that only cover part of a tile.
+ */
+class InkSums {
+public:
+  typedef boost::shared_ptr<InkSums> Ptr;
+
+  /** The sums of the C, M, Y and K values */
+  typedef std::array<uint64_t, 4> Sum;
+
+  /** Size (in pixels) of the square tiles that are summed */
+  static constexpr int TILE_SIZE = 64;
+
+private:
+  /** Size of the surface (in pixels) */
+  int width;
+  int height;
+
+  /** Number of tiles in a row and in a column */
+  int columns;
+  int rows;
+
+  /** The sums of the tiles, row by row */
+  std::vector<Sum> tiles;
+
+  /**
+   * Summed-area table of the tiles: entry (x, y) holds the sum of all tiles
+   * above and to the left of tile (x, y). Has a row and column more than
+   * tiles.
+   */
+  std::vector<Sum> table;
+
+  /** Whether table needs to be rebuilt from tiles */
+  bool dirty = true;
+
+  /** Protects tiles, table and dirty */
+  boost::mutex mtx;
+
+private:
+  /** Constructor */
+  InkSums(int width, int height);
+
+  /** Adds the ink values of the ARGB32 @param pixel to @param sum */
+  static void addPixel(const uint8_t *pixel, Sum &sum);
+
+  /** Adds the pixels in @param area of @param argb to @param sum */
+  static void addPixels(const uint8_t *argb, int stride,
+                        Scroom::Utils::Rectangle<int> area, Sum &sum);
+
+public:
+  /** Constructor, for a surface of @param width by @param height pixels */
+  static Ptr create(int width, int height);
+
+  /**
+   * Recomputes the sums of the tiles that intersect @param area (in pixels)
+   * from the ARGB32 surface @param argb, which has @param stride bytes per
+   * row.
+   */
+  void update(const uint8_t *argb, int stride,
+              Scroom::Utils::Rectangle<int> area);
+
+  /**
+   * Returns the sums of the ink values of the pixels in @param area (in
+   * pixels) of the ARGB32 surface @param argb, which has @param stride bytes
+   * per row. Only the parts of tiles along the edges are read from @param
+   * argb.
+   */
+  Sum getSum(const uint8_t *argb, int stride,
+             Scroom::Utils::Rectangle<int> area);
+};
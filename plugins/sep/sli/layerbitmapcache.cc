@@ -0,0 +1,63 @@
+#include "layerbitmapcache.hh"
+
+#include <boost/filesystem.hpp>
+
+boost::shared_ptr<LayerBitmapCache::Entry>
+LayerBitmapCache::getEntry(const Key &key) {
+  boost::mutex::scoped_lock lock(mtx);
+  auto &entry = entries[key];
+  if (!entry) {
+    prune();
+    entry = boost::make_shared<Entry>();
+  }
+  return entry;
+}
+
+void LayerBitmapCache::prune() {
+  for (auto it = entries.begin(); it != entries.end();) {
+    const auto &entry = it->second;
+    // Entries in use by load() are referenced elsewhere and must stay
+    if (entry && entry.use_count() == 1 && entry->bitmap.expired() &&
+        entry->compressedBitmap.expired() && entry->mappedBitmap.expired()) {
+      it = entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void LayerBitmapCache::load(
+    const SliLayer::Ptr &layer,
+    const boost::function<void(const SliLayer::Ptr &)> &decode) {
+  namespace fs = boost::filesystem;
+
+  boost::system::error_code ec;
+  fs::path path = fs::canonical(layer->filepath, ec);
+  uintmax_t fileSize = ec ? 0 : fs::file_size(path, ec);
+  std::time_t mtime = ec ? 0 : fs::last_write_time(path, ec);
+  if (ec) {
+    // Can't identify the file, so don't share it either
+    decode(layer);
+    return;
+  }
+
+  auto entry = getEntry(Key(path.string(), fileSize, mtime, layer->spp));
+  boost::mutex::scoped_lock lock(entry->mtx);
+
+  layer->bitmap = entry->bitmap.lock();
+  layer->compressedBitmap = entry->compressedBitmap.lock();
+  layer->mappedBitmap = entry->mappedBitmap.lock();
+  if (layer->hasBitmap())
+    return;
+
+  decode(layer);
+  entry->bitmap = layer->bitmap;
+  entry->compressedBitmap = layer->compressedBitmap;
+  entry->mappedBitmap = layer->mappedBitmap;
+}
+
+size_t LayerBitmapCache::size() {
+  boost::mutex::scoped_lock lock(mtx);
+  prune();
+  return entries.size();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <tuple>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "slilayer.hh"
+
+/**
+ * Plugin-wide cache of decoded layer bitmaps.
+ *
+ * Layers that refer to the same file (for example the repeats of a
+ * step-and-repeat job, or artwork shared by two open jobs) share a single
+ * decoded bitmap instead of each decoding their own copy. Only weak references
+ * are kept, so a bitmap is freed as soon as the last layer using it unloads.
+ */
+class LayerBitmapCache {
+private:
+  /** Identifies a file: canonical path, size, modification time and spp */
+  typedef std::tuple<std::string, uintmax_t, std::time_t, unsigned int> Key;
+
+  struct Entry {
+    /** Held while the bitmap is being decoded, so it is decoded only once */
+    boost::mutex mtx;
+
+    boost::weak_ptr<uint8_t[]> bitmap;
+    boost::weak_ptr<RleBitmap> compressedBitmap;
+    boost::weak_ptr<boost::interprocess::mapped_region> mappedBitmap;
+  };
+
+  /** Guards entries */
+  boost::mutex mtx;
+
+  std::map<Key, boost::shared_ptr<Entry>> entries;
+
+private:
+  LayerBitmapCache() = default;
+
+  /** Returns the entry for @param key, creating it if needed */
+  boost::shared_ptr<Entry> getEntry(const Key &key);
+
+  /** Removes the entries whose bitmaps have all been freed */
+  void prune();
+
+public:
+  static LayerBitmapCache &getInstance() {
+    static LayerBitmapCache INSTANCE;
+    return INSTANCE;
+  }
+
+  /**
+   * Gives @param layer the bitmap of its file. If another layer already holds
+   * that bitmap it is shared, otherwise @param decode is called to fill the
+   * layer and the result is remembered for the layers that follow.
+   * Requires SliLayer::fillMetaFromTiff() to have been called previously.
+   */
+  void load(const SliLayer::Ptr &layer,
+            const boost::function<void(const SliLayer::Ptr &)> &decode);
+
+  /** Returns the number of files currently in the cache */
+  size_t size();
+};
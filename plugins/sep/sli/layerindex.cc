@@ -0,0 +1,43 @@
+#include "layerindex.hh"
+
+#include <algorithm>
+#include <iterator>
+
+namespace bgi = boost::geometry::index;
+
+LayerIndex::LayerIndex(const std::vector<Scroom::Utils::Rectangle<int>> &rects)
+    : count(rects.size()) {
+  std::vector<Value> values;
+  for (size_t i = 0; i < rects.size(); i++) {
+    // Empty rectangles can't intersect anything
+    if (rects[i].getWidth() > 0 && rects[i].getHeight() > 0)
+      values.emplace_back(toBox(rects[i]), i);
+  }
+  tree = decltype(tree)(values.begin(), values.end());
+}
+
+LayerIndex::Ptr
+LayerIndex::create(const std::vector<Scroom::Utils::Rectangle<int>> &rects) {
+  return Ptr(new LayerIndex(rects));
+}
+
+LayerIndex::Box LayerIndex::toBox(const Scroom::Utils::Rectangle<int> &rect) {
+  // Boxes include their corners, so rectangles that only touch don't overlap
+  return Box(Point(rect.getLeft(), rect.getTop()),
+             Point(rect.getRight() - 1, rect.getBottom() - 1));
+}
+
+std::vector<size_t>
+LayerIndex::query(const Scroom::Utils::Rectangle<int> &area) const {
+  std::vector<size_t> result;
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return result;
+
+  std::vector<Value> found;
+  tree.query(bgi::intersects(toBox(area)), std::back_inserter(found));
+  result.reserve(found.size());
+  for (auto &value : found)
+    result.push_back(value.second);
+  std::sort(result.begin(), result.end());
+  return result;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <scroom/rectangle.hh>
+
+/**
+ * R-tree over the rectangles of the layers of an SLI file, so that the
+ * layers intersecting an area can be found without visiting every layer.
+ *
+ * The index is immutable. It is bulk loaded when created, which gives a
+ * better tree than inserting the rectangles one by one.
+ */
+class LayerIndex {
+public:
+  typedef boost::shared_ptr<LayerIndex> Ptr;
+
+private:
+  typedef boost::geometry::model::point<int, 2, boost::geometry::cs::cartesian>
+      Point;
+  typedef boost::geometry::model::box<Point> Box;
+  typedef std::pair<Box, size_t> Value;
+
+  /** The rectangles, each with its position in the vector it was made from */
+  boost::geometry::index::rtree<Value, boost::geometry::index::quadratic<16>>
+      tree;
+
+  /** Number of rectangles the index was made from, empty ones included */
+  size_t count;
+
+private:
+  /** Constructor */
+  explicit LayerIndex(const std::vector<Scroom::Utils::Rectangle<int>> &rects);
+
+  /** Returns the box of the pixels inside @param rect */
+  static Box toBox(const Scroom::Utils::Rectangle<int> &rect);
+
+public:
+  /** Constructor. Rectangles are identified by their index in @param rects */
+  static Ptr create(const std::vector<Scroom::Utils::Rectangle<int>> &rects);
+
+  /** Returns the number of rectangles the index was made from */
+  size_t size() const { return count; }
+
+  /**
+   * Returns the indexes of the rectangles that share at least one pixel with
+   * @param area, in increasing order.
+   */
+  std::vector<size_t> query(const Scroom::Utils::Rectangle<int> &area) const;
+};
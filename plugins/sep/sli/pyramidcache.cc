@@ -0,0 +1,226 @@
+#include "pyramidcache.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <gtk/gtk.h>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+namespace {
+const char MAGIC[8] = {'S', 'L', 'I', 'P', 'Y', 'R', '0', '1'};
+
+// Level data is aligned to this many bytes within the file
+const uint64_t ALIGNMENT = 64;
+
+struct Header {
+  char magic[8];
+  uint32_t keyLength;
+  uint32_t nLevels;
+};
+
+struct LevelEntry {
+  int32_t zoom;
+  int32_t width;
+  int32_t height;
+  int32_t stride;
+  uint64_t offset;
+};
+
+uint64_t alignUp(uint64_t value) {
+  return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+/**
+ * Lays out the file for @param levels stored under @param key, filling
+ * @param table with the entries of the levels.
+ * @return the size of the file
+ */
+uint64_t layoutFile(const std::string &key,
+                    const std::map<int, SurfaceWrapper::Ptr> &levels,
+                    std::vector<LevelEntry> &table) {
+  uint64_t offset = alignUp(sizeof(Header) + key.size() +
+                            levels.size() * sizeof(LevelEntry));
+  for (const auto &level : levels) {
+    auto &surface = level.second;
+    table.push_back({level.first, surface->getWidth(), surface->getHeight(),
+                     surface->getStride(), offset});
+    offset = alignUp(offset + static_cast<uint64_t>(surface->getStride()) *
+                                  surface->getHeight());
+  }
+  return offset;
+}
+
+/** 64-bit FNV-1a hash, only used to name the cache files */
+uint64_t hashKey(const std::string &key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+} // namespace
+
+PyramidCache::PyramidCache(fs::path directory_, uintmax_t budget_)
+    : directory(std::move(directory_)), budget(budget_) {}
+
+PyramidCache::Ptr PyramidCache::create(const fs::path &directory,
+                                       uintmax_t budget) {
+  return Ptr(new PyramidCache(directory, budget));
+}
+
+fs::path PyramidCache::defaultDirectory() {
+  return fs::path(g_get_user_cache_dir()) / "scroom" / "sli";
+}
+
+fs::path PyramidCache::pathFor(const std::string &key) {
+  return directory / (boost::format("%016x.pyr") % hashKey(key)).str();
+}
+
+bool PyramidCache::contains(const std::string &key) {
+  boost::system::error_code ec;
+  return fs::exists(pathFor(key), ec);
+}
+
+std::map<int, SurfaceWrapper::Ptr> PyramidCache::load(const std::string &key) {
+  std::map<int, SurfaceWrapper::Ptr> levels;
+  fs::path path = pathFor(key);
+  boost::system::error_code ec;
+  if (!fs::exists(path, ec))
+    return levels;
+
+  boost::shared_ptr<bip::mapped_region> region;
+  try {
+    bip::file_mapping file(path.string().c_str(), bip::read_only);
+    // Copy-on-write, so the surfaces can still be drawn on afterwards
+    region = boost::make_shared<bip::mapped_region>(file, bip::copy_on_write);
+  } catch (const bip::interprocess_exception &ex) {
+    printf("Mapping %s failed: %s\n", path.string().c_str(), ex.what());
+    return levels;
+  }
+
+  auto *data = static_cast<uint8_t *>(region->get_address());
+  uint64_t size = region->get_size();
+
+  Header header;
+  if (size < sizeof(header))
+    return levels;
+  memcpy(&header, data, sizeof(header));
+  uint64_t tableStart = sizeof(header) + header.keyLength;
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      tableStart + header.nLevels * sizeof(LevelEntry) > size ||
+      key.compare(0, std::string::npos,
+                  reinterpret_cast<const char *>(data + sizeof(header)),
+                  header.keyLength) != 0) {
+    // Corrupt file or hash collision
+    return levels;
+  }
+
+  for (uint32_t i = 0; i < header.nLevels; i++) {
+    LevelEntry entry;
+    memcpy(&entry, data + tableStart + i * sizeof(entry), sizeof(entry));
+    if (entry.offset % ALIGNMENT != 0 ||
+        entry.offset + static_cast<uint64_t>(entry.stride) * entry.height >
+            size) {
+      levels.clear();
+      return levels;
+    }
+    levels[entry.zoom] =
+        SurfaceWrapper::create(data + entry.offset, entry.width, entry.height,
+                               entry.stride, region);
+  }
+
+  // Mark the file as recently used
+  fs::last_write_time(path, std::time(nullptr), ec);
+  return levels;
+}
+
+bool PyramidCache::fits(const std::string &key,
+                        const std::map<int, SurfaceWrapper::Ptr> &levels) {
+  std::vector<LevelEntry> table;
+  return layoutFile(key, levels, table) <= budget;
+}
+
+bool PyramidCache::store(const std::string &key,
+                         const std::map<int, SurfaceWrapper::Ptr> &levels) {
+  std::vector<LevelEntry> table;
+  if (layoutFile(key, levels, table) > budget)
+    return false;
+
+  boost::system::error_code ec;
+  fs::create_directories(directory, ec);
+  if (ec)
+    return false;
+
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.keyLength = static_cast<uint32_t>(key.size());
+  header.nLevels = static_cast<uint32_t>(levels.size());
+
+  // Write to a temporary file first, so readers never see a partial pyramid
+  fs::path path = pathFor(key);
+  fs::path temporary = fs::unique_path(path.string() + ".%%%%%%%%.tmp", ec);
+  {
+    std::ofstream out(temporary.string(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(key.data(), key.size());
+    out.write(reinterpret_cast<const char *>(table.data()),
+              table.size() * sizeof(LevelEntry));
+
+    const char padding[ALIGNMENT] = {};
+    auto it = levels.begin();
+    for (const auto &entry : table) {
+      out.write(padding, entry.offset - out.tellp());
+      out.write(reinterpret_cast<const char *>(it->second->getBitmap()),
+                static_cast<std::streamsize>(entry.stride) * entry.height);
+      ++it;
+    }
+    if (!out) {
+      out.close();
+      fs::remove(temporary, ec);
+      return false;
+    }
+  }
+
+  fs::rename(temporary, path, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+    return false;
+  }
+
+  prune();
+  return true;
+}
+
+void PyramidCache::prune() {
+  boost::system::error_code ec;
+  std::vector<std::pair<std::time_t, fs::path>> files;
+  uintmax_t used = 0;
+  for (fs::directory_iterator it(directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().extension() != ".pyr")
+      continue;
+    uintmax_t size = fs::file_size(it->path(), ec);
+    std::time_t mtime = fs::last_write_time(it->path(), ec);
+    if (ec)
+      continue;
+    used += size;
+    files.emplace_back(mtime, it->path());
+  }
+
+  std::sort(files.begin(), files.end());
+  for (auto &file : files) {
+    if (used <= budget)
+      break;
+    uintmax_t size = fs::file_size(file.second, ec);
+    if (!ec && fs::remove(file.second, ec))
+      used -= size;
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "sli-helpers.hh"
+
+/**
+ * Persistent disk cache for the rendered zoom level pyramids of SLI files.
+ *
+ * Every pyramid is stored in its own file, named after a hash of its key. All
+ * levels are stored in the layout of a cairo surface, so a cached pyramid is
+ * loaded by mapping the file copy-on-write and wrapping the levels directly.
+ * The least recently used files are removed once the cache grows beyond its
+ * budget.
+ */
+class PyramidCache {
+public:
+  typedef boost::shared_ptr<PyramidCache> Ptr;
+
+private:
+  /** Directory holding the cache files */
+  boost::filesystem::path directory;
+
+  /** Number of bytes the cache files may occupy together */
+  uintmax_t budget;
+
+private:
+  PyramidCache(boost::filesystem::path directory, uintmax_t budget);
+
+  /** Returns the path of the cache file for @param key */
+  boost::filesystem::path pathFor(const std::string &key);
+
+  /** Removes the least recently used files until the budget is met */
+  void prune();
+
+public:
+  /**
+   * Constructor
+   * @param directory the directory to keep the cache files in. It is created
+   * when needed.
+   * @param budget the maximum number of bytes used by the cache files
+   */
+  static Ptr create(const boost::filesystem::path &directory,
+                    uintmax_t budget = static_cast<uintmax_t>(4096) * 1024 *
+                                       1024);
+
+  /** Returns the per-user cache directory for SLI pyramids */
+  static boost::filesystem::path defaultDirectory();
+
+  /** Whether a pyramid is cached for @param key */
+  bool contains(const std::string &key);
+
+  /**
+   * Maps the pyramid cached for @param key.
+   * @return the surfaces per zoom level, or an empty map if there is no
+   * (valid) pyramid cached for @param key
+   */
+  std::map<int, SurfaceWrapper::Ptr> load(const std::string &key);
+
+  /**
+   * Whether the pyramid @param levels fits in the budget when stored under
+   * @param key. Larger pyramids are not stored, prune() would remove them
+   * right away.
+   */
+  bool fits(const std::string &key,
+            const std::map<int, SurfaceWrapper::Ptr> &levels);
+
+  /**
+   * Writes the pyramid @param levels under @param key, replacing any previous
+   * pyramid for that key.
+   * @return true on success, false if it failed or the pyramid doesn't fit
+   */
+  bool store(const std::string &key,
+             const std::map<int, SurfaceWrapper::Ptr> &levels);
+};
@@ -0,0 +1,103 @@
+#include "rlebitmap.hh"
+
+#include <algorithm>
+#include <cstring>
+
+// A header byte below RUN_BASE announces (header + 1) literal pixels, any
+// other value a single pixel that is repeated (header - RUN_BASE + 2) times.
+static const int RUN_BASE = 128;
+static const int MAX_LITERAL = 128;
+static const int MAX_RUN = 129;
+
+RleBitmap::RleBitmap(int rowBytes_, int rows_, int bpp_)
+    : rowBytes(rowBytes_), rows(rows_), bpp(bpp_) {}
+
+RleBitmap::Ptr RleBitmap::create(const uint8_t *bitmap, int width, int height,
+                                 int bpp) {
+  RleBitmap::Ptr result(new RleBitmap(width * bpp, height, bpp));
+
+  int nTiles = (height + TILE_ROWS - 1) / TILE_ROWS;
+  result->tiles.resize(nTiles);
+  for (int tile = 0; tile < nTiles; tile++) {
+    int tileRows = std::min(TILE_ROWS, height - tile * TILE_ROWS);
+    result->encodeTile(bitmap + tile * TILE_ROWS * result->rowBytes,
+                       tileRows * width, result->tiles[tile]);
+    result->tiles[tile].shrink_to_fit();
+    result->size += result->tiles[tile].size();
+  }
+
+  return result;
+}
+
+void RleBitmap::encodeTile(const uint8_t *source, int pixels,
+                           std::vector<uint8_t> &out) {
+  auto samePixel = [&](int a, int b) {
+    return memcmp(source + a * bpp, source + b * bpp, bpp) == 0;
+  };
+
+  int i = 0;
+  while (i < pixels) {
+    int run = 1;
+    while (i + run < pixels && run < MAX_RUN && samePixel(i, i + run))
+      run++;
+
+    if (run >= 2) {
+      out.push_back(static_cast<uint8_t>(RUN_BASE + run - 2));
+      out.insert(out.end(), source + i * bpp, source + (i + 1) * bpp);
+      i += run;
+      continue;
+    }
+
+    // Collect literal pixels until the next run starts
+    int start = i;
+    while (i < pixels && i - start < MAX_LITERAL) {
+      if (i + 1 < pixels && samePixel(i, i + 1))
+        break;
+      i++;
+    }
+    out.push_back(static_cast<uint8_t>(i - start - 1));
+    out.insert(out.end(), source + start * bpp, source + i * bpp);
+  }
+}
+
+void RleBitmap::decodeTile(int tile, uint8_t *target) {
+  const uint8_t *current = tiles[tile].data();
+  const uint8_t *end = current + tiles[tile].size();
+
+  while (current < end) {
+    int header = *current++;
+    if (header < RUN_BASE) {
+      size_t n = (header + 1) * bpp;
+      memcpy(target, current, n);
+      target += n;
+      current += n;
+    } else {
+      int n = header - RUN_BASE + 2;
+      if (bpp == 1) {
+        memset(target, *current, n);
+        target += n;
+      } else {
+        for (int j = 0; j < n; j++) {
+          memcpy(target, current, bpp);
+          target += bpp;
+        }
+      }
+      current += bpp;
+    }
+  }
+}
+
+const uint8_t *RleBitmap::decodeRows(int firstRow, int rowCount,
+                                     std::vector<uint8_t> &scratch) {
+  int firstTile = firstRow / TILE_ROWS;
+  int lastTile = (std::min(rows, firstRow + rowCount) - 1) / TILE_ROWS;
+  size_t tileBytes = static_cast<size_t>(TILE_ROWS) * rowBytes;
+
+  if (scratch.size() < (lastTile - firstTile + 1) * tileBytes)
+    scratch.resize((lastTile - firstTile + 1) * tileBytes);
+
+  for (int tile = firstTile; tile <= lastTile; tile++)
+    decodeTile(tile, scratch.data() + (tile - firstTile) * tileBytes);
+
+  return scratch.data() + (firstRow - firstTile * TILE_ROWS) * rowBytes;
+}
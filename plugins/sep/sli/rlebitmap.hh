@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Run-length encoded copy of an SLI layer bitmap.
+ *
+ * The bitmap is cut into tiles of TILE_ROWS rows that are encoded
+ * independently, so the compositor only has to decode the rows it is
+ * currently drawing. Runs are counted in whole pixels rather than bytes,
+ * because interleaved CMYK data of a flat area repeats every `bpp` bytes.
+ */
+class RleBitmap {
+public:
+  typedef boost::shared_ptr<RleBitmap> Ptr;
+
+  /** Number of rows encoded together in one tile */
+  static constexpr int TILE_ROWS = 8;
+
+private:
+  /** Number of bytes in one row of the decoded bitmap */
+  int rowBytes;
+
+  /** Number of rows in the decoded bitmap */
+  int rows;
+
+  /** Number of bytes in one pixel (= samples per pixel) */
+  int bpp;
+
+  /** The encoded tiles, from top to bottom */
+  std::vector<std::vector<uint8_t>> tiles;
+
+  /** Total number of bytes used by the encoded tiles */
+  size_t size = 0;
+
+private:
+  /** Constructor */
+  RleBitmap(int rowBytes, int rows, int bpp);
+
+  /** Encodes @param pixels pixels starting at @param source into @param out */
+  void encodeTile(const uint8_t *source, int pixels, std::vector<uint8_t> &out);
+
+  /** Decodes tile @param tile into @param target */
+  void decodeTile(int tile, uint8_t *target);
+
+public:
+  /**
+   * Encode a bitmap.
+   * @param bitmap the raw, interleaved bitmap data
+   * @param width the width of the bitmap (in pixels)
+   * @param height the height of the bitmap (in pixels)
+   * @param bpp the number of bytes per pixel
+   */
+  static Ptr create(const uint8_t *bitmap, int width, int height, int bpp);
+
+  /** Returns the number of bytes the encoded bitmap occupies */
+  size_t getSize() { return size; }
+
+  /**
+   * Decode all tiles covering rows [@param firstRow, @param firstRow +
+   * @param rowCount) into @param scratch, growing it if needed.
+   * @return a pointer to the start of @param firstRow inside @param scratch
+   */
+  const uint8_t *decodeRows(int firstRow, int rowCount,
+                            std::vector<uint8_t> &scratch);
+};
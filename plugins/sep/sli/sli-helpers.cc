@@ -1,6 +1,27 @@
 #include "sli-helpers.hh"
 #include "../sep-helpers.hh"
 
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace {
+/** Owns the mapping of a temporary file and removes the file afterwards */
+struct TemporaryMapping {
+  boost::filesystem::path path;
+  boost::interprocess::mapped_region region;
+
+  ~TemporaryMapping() {
+    // Unmap first, some platforms refuse to remove mapped files
+    boost::interprocess::mapped_region().swap(region);
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+  }
+};
+} // namespace
+
 SurfaceWrapper::Ptr SurfaceWrapper::create() {
   SurfaceWrapper::Ptr result(new SurfaceWrapper());
 
@@ -14,6 +35,42 @@ SurfaceWrapper::Ptr SurfaceWrapper::create(int width, int height,
   return result;
 }
 
+SurfaceWrapper::Ptr SurfaceWrapper::create(uint8_t *data, int width,
+                                           int height, int stride,
+                                           boost::shared_ptr<void> owner) {
+  SurfaceWrapper::Ptr result(
+      new SurfaceWrapper(data, width, height, stride, std::move(owner)));
+
+  return result;
+}
+
+SurfaceWrapper::Ptr SurfaceWrapper::createFileBacked(int width, int height) {
+  namespace fs = boost::filesystem;
+  namespace bip = boost::interprocess;
+
+  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+  auto mapping = boost::make_shared<TemporaryMapping>();
+  try {
+    mapping->path = fs::temp_directory_path() /
+                    fs::unique_path("scroom-sli-%%%%-%%%%-%%%%.tmp");
+    // A newly extended file reads as zeros, just like calloc'ed memory
+    std::ofstream(mapping->path.string(), std::ios::binary).close();
+    fs::resize_file(mapping->path, static_cast<uintmax_t>(stride) * height);
+    bip::file_mapping file(mapping->path.string().c_str(), bip::read_write);
+    bip::mapped_region(file, bip::read_write).swap(mapping->region);
+  } catch (const std::exception &ex) {
+    printf("Creating a file backed surface failed, using memory instead: "
+           "%s\n",
+           ex.what());
+    return create(width, height, CAIRO_FORMAT_ARGB32);
+  }
+
+  auto *data = static_cast<uint8_t *>(mapping->region.get_address());
+  Ptr result = create(data, width, height, stride, mapping);
+  result->clear = true;
+  return result;
+}
+
 SurfaceWrapper::SurfaceWrapper() {
   clear = true;
   empty = true;
@@ -28,6 +85,15 @@ SurfaceWrapper::SurfaceWrapper(int width, int height, cairo_format_t format) {
   clear = true;
 }
 
+SurfaceWrapper::SurfaceWrapper(uint8_t *data, int width, int height,
+                               int stride, boost::shared_ptr<void> owner)
+    : dataOwner(std::move(owner)) {
+  surface = cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32,
+                                                width, height, stride);
+  empty = false;
+  clear = false;
+}
+
 int SurfaceWrapper::getHeight() {
   return cairo_image_surface_get_height(surface);
 }
@@ -92,8 +158,8 @@ int pointToOffset(Scroom::Utils::Rectangle<int> rect,
 }
 
 Scroom::Utils::Rectangle<int>
-spannedRectangle(boost::dynamic_bitset<> bitmap,
-                 std::vector<SliLayer::Ptr> layers, bool fromOrigin) {
+spannedRectangle(const boost::dynamic_bitset<> &bitmap,
+                 const std::vector<SliLayer::Ptr> &layers, bool fromOrigin) {
   int min_x0 = INT_MAX;
   int min_y0 = INT_MAX;
   int max_x1 = INT_MIN;
@@ -104,10 +170,8 @@ spannedRectangle(boost::dynamic_bitset<> bitmap,
     min_y0 = 0;
   }
 
-  for (size_t i = 0; i < bitmap.size(); i++) {
-    if (!bitmap[i])
-      continue;
-
+  for (size_t i = bitmap.find_first(); i != boost::dynamic_bitset<>::npos;
+       i = bitmap.find_next(i)) {
     auto rect = layers[i]->toRectangle();
 
     if (rect.getLeft() < min_x0)
@@ -156,7 +220,8 @@ halfSegBitmask(boost::dynamic_bitset<> toggledSegments) {
 
 SurfaceWrapper::~SurfaceWrapper() {
   if (!empty) {
-    free(cairo_image_surface_get_data(surface));
+    if (!dataOwner)
+      free(cairo_image_surface_get_data(surface));
     cairo_surface_destroy(surface);
   }
 }
\ No newline at end of file
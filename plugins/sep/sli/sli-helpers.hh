@@ -23,14 +23,34 @@ public:
 private:
   /** Used to destroy SurfaceWrapper pointers with no surface */
   bool empty;
+
+  /** Keeps external surface data alive. The data is only freed if unset. */
+  boost::shared_ptr<void> dataOwner;
+
   SurfaceWrapper();
   SurfaceWrapper(int width, int height, cairo_format_t format);
+  SurfaceWrapper(uint8_t *data, int width, int height, int stride,
+                 boost::shared_ptr<void> owner);
 
 public:
   /** Constructors */
   static Ptr create();
   static Ptr create(int width, int height, cairo_format_t format);
 
+  /**
+   * Wrap existing ARGB32 data, e.g. a memory mapped file, instead of
+   * allocating it. @param owner is kept alive as long as the surface is.
+   */
+  static Ptr create(uint8_t *data, int width, int height, int stride,
+                    boost::shared_ptr<void> owner);
+
+  /**
+   * Create an ARGB32 surface backed by a temporary file in the system's
+   * temporary directory rather than by memory, so the OS can page it out.
+   * Falls back to a regular surface if the file can't be created.
+   */
+  static Ptr createFileBacked(int width, int height);
+
   /** Get the height of the wrapped surface */
   virtual int getHeight();
 
@@ -82,8 +102,9 @@ int pointToOffset(Scroom::Utils::Rectangle<int> rect,
  * layers will be used instead.
  */
 Scroom::Utils::Rectangle<int>
-spannedRectangle(boost::dynamic_bitset<> bitmap,
-                 std::vector<SliLayer::Ptr> layers, bool fromOrigin = false);
+spannedRectangle(const boost::dynamic_bitset<> &bitmap,
+                 const std::vector<SliLayer::Ptr> &layers,
+                 bool fromOrigin = false);
 
 /**
  * Finds the multiple of 2 whose size best approximates splitting @param height
@@ -1,7 +1,11 @@
 #include "slilayer.hh"
 #include "../colorconfig/CustomColorConfig.hh"
 #include "../sep-helpers.hh"
+#include <algorithm>
 #include <boost/format.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstring>
 #include <tiffio.h>
 
 #define TIFFGetFieldChecked(file, field, ...)                                  \
@@ -21,6 +25,11 @@ SliLayer::Ptr SliLayer::create(const std::string &filepath,
 
 SliLayer::SliLayer() : height(0), width(0) {}
 
+SliLayer::~SliLayer() {
+  if (rowReader)
+    TIFFClose(rowReader);
+}
+
 Scroom::Utils::Rectangle<int> SliLayer::toRectangle() {
   Scroom::Utils::Rectangle<int> rect{xoffset, yoffset, width, height};
 
@@ -131,3 +140,201 @@ void SliLayer::fillBitmapFromTiff() {
     Show(errorFormat.str(), GTK_MESSAGE_ERROR);
   }
 }
+
+bool SliLayer::mapBitmapFromTiff() {
+  namespace bip = boost::interprocess;
+
+  TIFF *tif = TIFFOpen(filepath.c_str(), "r");
+  if (!tif)
+    return false;
+
+  const size_t size = static_cast<size_t>(width) * height * spp;
+  uint16 compression = 0;
+  uint16 planarConfig = 0;
+  toff_t *offsets = nullptr;
+  toff_t *byteCounts = nullptr;
+  bool contiguous =
+      bps == 8 && !TIFFIsTiled(tif) &&
+      TIFFScanlineSize(tif) == static_cast<tmsize_t>(width * spp) &&
+      TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression) &&
+      compression == COMPRESSION_NONE &&
+      TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planarConfig) &&
+      planarConfig == PLANARCONFIG_CONTIG &&
+      TIFFGetField(tif, TIFFTAG_STRIPOFFSETS, &offsets) &&
+      TIFFGetField(tif, TIFFTAG_STRIPBYTECOUNTS, &byteCounts);
+
+  // The strips have to follow each other directly in the file
+  toff_t start = 0;
+  if (contiguous) {
+    start = offsets[0];
+    toff_t end = start;
+    for (uint32 i = 0; i < TIFFNumberOfStrips(tif) && contiguous; i++) {
+      contiguous = offsets[i] == end;
+      end += byteCounts[i];
+    }
+    contiguous = contiguous && end - start >= size;
+  }
+  TIFFClose(tif);
+
+  if (!contiguous || size == 0)
+    return false;
+
+  try {
+    bip::file_mapping file(filepath.c_str(), bip::read_only);
+    mappedBitmap = boost::make_shared<bip::mapped_region>(
+        file, bip::read_only, static_cast<bip::offset_t>(start), size);
+  } catch (const bip::interprocess_exception &ex) {
+    printf("Mapping %s failed, copying it instead: %s\n", filepath.c_str(),
+           ex.what());
+    return false;
+  }
+  return true;
+}
+
+bool SliLayer::compressBitmap() {
+  if (!bitmap)
+    return false;
+
+  auto compressed = RleBitmap::create(bitmap.get(), width, height, spp);
+  size_t rawSize = static_cast<size_t>(width) * height * spp;
+  if (compressed->getSize() * 2 > rawSize)
+    return false;
+
+  compressedBitmap = compressed;
+  bitmap.reset();
+  return true;
+}
+
+bool SliLayer::hasBitmap() {
+  return bitmap || compressedBitmap || mappedBitmap;
+}
+
+size_t SliLayer::getBitmapSize() {
+  size_t size = getMipmapsSize();
+  if (compressedBitmap)
+    return size + compressedBitmap->getSize();
+  if (bitmap)
+    return size + static_cast<size_t>(width) * height * spp;
+  return size;
+}
+
+size_t SliLayer::getMipmapsSize() {
+  size_t size = 0;
+  for (auto &mipmap : mipmaps)
+    size += mipmap.second.data.size();
+  return size;
+}
+
+const void *SliLayer::getBitmapId() {
+  if (compressedBitmap)
+    return compressedBitmap.get();
+  return bitmap.get();
+}
+
+const LayerMipmap &SliLayer::getMipmap(int zoom) {
+  auto it = mipmaps.find(zoom);
+  if (it != mipmaps.end())
+    return it->second;
+
+  const int k = -zoom;
+  LayerMipmap &mipmap = mipmaps[zoom];
+  int left = xoffset >> k;
+  int top = yoffset >> k;
+  int right = ((xoffset + width - 1) >> k) + 1;
+  int bottom = ((yoffset + height - 1) >> k) + 1;
+  mipmap.rect = {left, top, right - left, bottom - top};
+
+  const size_t rowBytes = static_cast<size_t>(width) * spp;
+  const size_t mipmapStride = static_cast<size_t>(right - left) * spp;
+  mipmap.data.resize(mipmapStride * (bottom - top));
+  std::vector<uint64_t> sums(mipmapStride);
+  std::vector<uint8_t> scratch;
+  for (int y = top; y < bottom; y++) {
+    // The rows of the layer covered by this row of the mipmap
+    int firstRow = std::max(0, (y << k) - yoffset);
+    int lastRow = std::min(height, ((y + 1) << k) - yoffset);
+    const uint8_t *rows = getBitmapRows(firstRow, lastRow - firstRow, scratch);
+
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int row = 0; row < lastRow - firstRow; row++) {
+      const uint8_t *pixel = rows + row * rowBytes;
+      for (int x = 0; x < width; x++) {
+        uint64_t *sum = sums.data() + (((xoffset + x) >> k) - left) * spp;
+        for (unsigned int c = 0; c < spp; c++)
+          sum[c] += *pixel++;
+      }
+    }
+
+    // Parts of the square outside the layer hold no ink
+    uint8_t *target = mipmap.data.data() + (y - top) * mipmapStride;
+    const uint64_t half = uint64_t(1) << (2 * k - 1);
+    for (size_t i = 0; i < mipmapStride; i++)
+      target[i] = static_cast<uint8_t>((sums[i] + half) >> (2 * k));
+  }
+  return mipmap;
+}
+
+ColorTransform::Ptr SliLayer::getColorTransform() {
+  // The bands of a layer are drawn in parallel, so they may race to compile
+  // it. Any of their results will do.
+  ColorTransform::Ptr transform = boost::atomic_load(&colorTransform);
+  if (!transform || !transform->matches(channels)) {
+    transform = ColorTransform::get(channels);
+    boost::atomic_store(&colorTransform, transform);
+  }
+  return transform;
+}
+
+void SliLayer::unloadBitmap() {
+  bitmap.reset();
+  compressedBitmap.reset();
+  mappedBitmap.reset();
+  mipmaps.clear();
+}
+
+const uint8_t *SliLayer::getBitmapRows(int firstRow, int rowCount,
+                                       std::vector<uint8_t> &scratch) {
+  if (compressedBitmap)
+    return compressedBitmap->decodeRows(firstRow, rowCount, scratch);
+
+  if (mappedBitmap)
+    return static_cast<const uint8_t *>(mappedBitmap->get_address()) +
+           static_cast<size_t>(firstRow) * width * spp;
+
+  return bitmap.get() + static_cast<size_t>(firstRow) * width * spp;
+}
+
+const uint8_t *SliLayer::readBitmapRows(int firstRow, int rowCount,
+                                        std::vector<uint8_t> &scratch) {
+  boost::mutex::scoped_lock lock(rowReaderMtx);
+  const size_t stride = static_cast<size_t>(width) * spp;
+  scratch.resize(rowCount * stride);
+
+  if (!rowReader)
+    rowReader = TIFFOpen(filepath.c_str(), "r");
+
+  bool success = rowReader != nullptr;
+  if (success) {
+    // The scanline can be padded, so read it into a buffer of its own.
+    // Reading on from the previous band avoids decoding compressed strips
+    // from their start again.
+    std::vector<uint8_t> line(
+        std::max<size_t>(TIFFScanlineSize(rowReader), stride));
+    for (int row = 0; row < rowCount && success; row++) {
+      success = TIFFReadScanline(rowReader, line.data(), firstRow + row) >= 0;
+      memcpy(scratch.data() + row * stride, line.data(), stride);
+    }
+  }
+  if (success)
+    return scratch.data();
+
+  if (!rowReadFailed) {
+    rowReadFailed = true;
+    boost::format errorFormat =
+        boost::format("Error: Failed to read rows %d to %d of file %s") %
+        firstRow % (firstRow + rowCount) % filepath.c_str();
+    printf("%s\n", errorFormat.str().c_str());
+    Show(errorFormat.str(), GTK_MESSAGE_ERROR);
+  }
+  return nullptr;
+}
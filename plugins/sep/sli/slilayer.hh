@@ -1,10 +1,32 @@
 #pragma once
 
+#include <map>
 #include <memory>
 
+#include <boost/thread/mutex.hpp>
+
+#include "../colorconfig/ColorTransform.hh"
 #include "../colorconfig/CustomColor.hh"
+#include "rlebitmap.hh"
 #include <scroom/scroominterface.hh>
 
+struct tiff;
+
+namespace boost {
+namespace interprocess {
+class mapped_region;
+}
+} // namespace boost
+
+/** A reduced copy of the bitmap of a layer, aligned to the canvas */
+struct LayerMipmap {
+  /** Position and size of the mipmap (in pixels of its zoom level) */
+  Scroom::Utils::Rectangle<int> rect;
+
+  /** Averaged samples, interleaved like those of the bitmap */
+  std::vector<uint8_t> data;
+};
+
 class SliLayer : public virtual Scroom::Utils::Base {
 public:
   typedef boost::shared_ptr<SliLayer> Ptr;
@@ -46,8 +68,40 @@ public:
   /** Absolute filepath to the tiff/sep file */
   std::string filepath;
 
-  /** The memory chunk containing the bitmap */
-  std::unique_ptr<uint8_t[]> bitmap;
+  /**
+   * The memory chunk containing the bitmap. Layers of the same file share it,
+   * see LayerBitmapCache.
+   */
+  boost::shared_ptr<uint8_t[]> bitmap;
+
+  /**
+   * Run-length encoded version of the bitmap. When set, it replaces the raw
+   * bitmap, which is then freed.
+   */
+  RleBitmap::Ptr compressedBitmap;
+
+  /**
+   * Read-only memory map of the bitmap data inside an uncompressed TIFF file.
+   * When set, it is used instead of bitmap.
+   */
+  boost::shared_ptr<boost::interprocess::mapped_region> mappedBitmap;
+
+  /** The mipmaps built so far, by zoom level. Freed with the bitmap. */
+  std::map<int, LayerMipmap> mipmaps;
+
+private:
+  /** The transform compiled from channels, see getColorTransform() */
+  ColorTransform::Ptr colorTransform;
+
+private:
+  /** The TIFF file kept open by readBitmapRows(), so it is opened once */
+  struct tiff *rowReader = nullptr;
+
+  /** Protects rowReader, which reads one scanline at a time */
+  boost::mutex rowReaderMtx;
+
+  /** Whether a failure of readBitmapRows() has been reported already */
+  bool rowReadFailed = false;
 
 private:
   SliLayer();
@@ -58,7 +112,7 @@ public:
                     int xoffset, int yoffset);
 
   /** Destructor */
-  ~SliLayer() override = default;
+  ~SliLayer() override;
 
   /** Returns the Rectangle representation of the layer (in pixels) */
   virtual Scroom::Utils::Rectangle<int> toRectangle();
@@ -79,4 +133,75 @@ public:
    * Requires fillMetaFromTiff() to have been called previously
    */
   virtual void fillBitmapFromTiff();
+
+  /**
+   * Maps the TIFF files' bitmap data into memory instead of copying it. Only
+   * possible for uncompressed, contiguous TIFF files whose strips are stored
+   * back to back. Requires fillMetaFromTiff() to have been called previously.
+   * @return true if the bitmap is now mapped, false if the file does not
+   * qualify and fillBitmapFromTiff() should be used instead
+   */
+  virtual bool mapBitmapFromTiff();
+
+  /**
+   * Replaces the raw bitmap by a run-length encoded one, if that at least
+   * halves its memory footprint.
+   * @return true if the bitmap is now stored compressed
+   */
+  virtual bool compressBitmap();
+
+  /** Whether the bitmap data (raw or compressed) has been loaded */
+  virtual bool hasBitmap();
+
+  /**
+   * Returns the number of bytes of memory held by the bitmap data and the
+   * mipmaps. Mapped bitmaps live in the page cache, which the OS reclaims by
+   * itself, so they don't count.
+   */
+  virtual size_t getBitmapSize();
+
+  /** Returns the number of bytes of memory held by the mipmaps alone */
+  virtual size_t getMipmapsSize();
+
+  /**
+   * Identifies the bitmap data held in memory, which layers of the same file
+   * share (see LayerBitmapCache). nullptr if there is none or it is mapped.
+   */
+  virtual const void *getBitmapId();
+
+  /**
+   * Returns the mipmap of the layer at zoom level @param zoom (< 0), building
+   * it from the bitmap if needed. Every sample averages a square of
+   * 2^-zoom by 2^-zoom pixels of the canvas, so that the mipmaps of all
+   * layers line up. Requires the bitmap to be loaded.
+   */
+  virtual const LayerMipmap &getMipmap(int zoom);
+
+  /**
+   * Returns the transform of the current channels to CMYK, compiling it again
+   * if the channels were replaced. Safe to call from several threads.
+   */
+  virtual ColorTransform::Ptr getColorTransform();
+
+  /** Frees the bitmap data. It can be loaded again afterwards. */
+  virtual void unloadBitmap();
+
+  /**
+   * Get a pointer to rows [@param firstRow, @param firstRow + @param rowCount)
+   * of the bitmap. Compressed bitmaps are decoded into @param scratch, raw
+   * bitmaps are returned directly.
+   */
+  virtual const uint8_t *getBitmapRows(int firstRow, int rowCount,
+                                       std::vector<uint8_t> &scratch);
+
+  /**
+   * Reads rows [@param firstRow, @param firstRow + @param rowCount) straight
+   * from the TIFF file into @param scratch, without loading the bitmap.
+   * The file stays open for the reads that follow. Requires
+   * fillMetaFromTiff() to have been called previously.
+   * @return a pointer to the rows inside @param scratch, or nullptr if they
+   * could not be read
+   */
+  virtual const uint8_t *readBitmapRows(int firstRow, int rowCount,
+                                        std::vector<uint8_t> &scratch);
 };
@@ -28,13 +28,23 @@ SliPresentation::create(ScroomInterface::Ptr scroomInterface_) {
                   result->shared_from_this<SliPresentation>());
   result->source = SliSource::create(result->triggerRedrawFunc);
 
+  // Recolor when the colours file changes
+  boost::weak_ptr<SliSource> weakSource = result->source;
+  result->colorListener = ColorConfig::getInstance().addListener(
+      [weakSource](ColorTable::ConstPtr colors) {
+        if (SliSource::Ptr source = weakSource.lock())
+          source->setColors(colors);
+      });
+
   return result;
 }
 
-SliPresentation::~SliPresentation() {}
+SliPresentation::~SliPresentation() {
+  ColorConfig::getInstance().removeListener(colorListener);
+}
 
 bool SliPresentation::load(const std::string &fileName) {
-  ColorConfig::getInstance().loadFile();
+  ColorConfig::getInstance().watchFile();
   filepath = fileName;
   if (!parseSli(fileName)) {
     return false;
@@ -44,6 +54,8 @@ bool SliPresentation::load(const std::string &fileName) {
   source->toggled.resize(source->layers.size(), true);
   source->computeHeightWidth();
   source->checkXoffsets();
+  source->checkMemoryFootprint();
+  source->queryImportBitmaps();
 
   transformationData = TransformationData::create();
   float xAspect = Xresolution / std::max(Xresolution, Yresolution);
@@ -142,7 +154,6 @@ bool SliPresentation::parseSli(const std::string &sliFileName) {
     }
   }
   if (Xresolution > 0 && Yresolution > 0 && source->layers.size() > 0) {
-    source->queryImportBitmaps();
     return true;
   }
   std::string error = "Error: SLI file does not define all required parameters";
@@ -189,7 +200,7 @@ Scroom::Utils::Rectangle<double> SliPresentation::getRect() {
 void SliPresentation::redraw(ViewInterface::Ptr const &vi, cairo_t *cr,
                              Scroom::Utils::Rectangle<double> presentationArea,
                              int zoom) {
-  UNUSED(vi);
+  source->setViewArea(vi, presentationArea.toIntRectangle(), zoom);
   GdkRectangle presentArea = presentationArea.toGdkRectangle();
   Scroom::Utils::Rectangle<double> actualPresentationArea = getRect();
   double pixelSize = pixelSizeFromZoom(zoom);
@@ -275,6 +286,7 @@ void SliPresentation::viewAdded(ViewInterface::WeakPtr vi) {
 
 void SliPresentation::viewRemoved(ViewInterface::WeakPtr vi) {
   views.erase(vi);
+  source->removeViewArea(vi);
   // If the view contains the control panel, attach the control panel to another
   // view
   if (!views.empty() && vi.lock() == controlPanel->viewWeak.lock()) {
@@ -297,44 +309,11 @@ SliPresentation::getPixelAverages(Scroom::Utils::Rectangle<int> area) {
     return {};
 
   auto surfaceWrapper = source->getSurface(0);
-  int stride = surfaceWrapper->getStride();
-  uint8_t *surfaceBegin =
-      cairo_image_surface_get_data(source->getSurface(0)->surface);
   Scroom::Utils::Rectangle<int> intersectionPixels =
       area.intersection(surfaceWrapper->toRectangle());
-  Scroom::Utils::Rectangle<int> intersectionBytes =
-      toBytesRectangle(intersectionPixels);
-  int offset = pointToOffset(intersectionBytes.getTopLeft(), stride);
-  int offsetEnd =
-      pointToOffset(intersectionBytes.getBottomRight(), stride) - stride;
-
-  uint8_t A;
-  double R, G, B, c, m, y, k;
-  double C = 0, Y = 0, M = 0, K = 0;
-
-  for (; offset < offsetEnd; offset += 4) // SPP = 4
-  {
-    if (offset % stride == intersectionBytes.getRight() % stride)
-      offset += stride - intersectionBytes.getWidth();
-
-    B = surfaceBegin[offset + 0];
-    G = surfaceBegin[offset + 1];
-    R = surfaceBegin[offset + 2];
-    A = surfaceBegin[offset + 3];
-
-    c = (255.0 - R);
-    m = (255.0 - G);
-    y = (255.0 - B);
-    k = std::min({c, m, y});
-
-    // transparent -> only the white background of Scroom remains visible
-    if (A != 0) {
-      C += c - k;
-      M += m - k;
-      Y += y - k;
-      K += k;
-    }
-  }
+  // Summed from tiles, so the size of the area hardly matters
+  InkSums::Sum sums = source->getInkSums(intersectionPixels);
+  double C = sums[0], M = sums[1], Y = sums[2], K = sums[3];
 
   PipetteLayerOperations::PipetteColor result = {
       {"C", C / getArea(intersectionPixels)},
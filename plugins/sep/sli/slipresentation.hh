@@ -60,6 +60,9 @@ private:
   /** The absolute path to the SLI file */
   std::string filepath;
 
+  /** Id of the listener for color changes */
+  unsigned int colorListener;
+
 private:
   /** Constructor */
   SliPresentation(ScroomInterface::Ptr scroomInterface);
@@ -1,15 +1,31 @@
 #include "slisource.hh"
-#include "../colorconfig/CustomColorHelpers.hh"
 #include "../sep-helpers.hh"
 #include "../sepsource.hh"
+#include "layerbitmapcache.hh"
 
 #include <scroom/bitmap-helpers.hh>
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace {
+/** Copies @param rows rows of @param rowBytes bytes between two buffers */
+void copyRows(uint8_t *target, int targetStride, const uint8_t *source,
+              int sourceStride, int rowBytes, int rows) {
+  for (int y = 0; y < rows; y++)
+    memcpy(target + y * targetStride, source + y * sourceStride, rowBytes);
+}
+} // namespace
+
 SliSource::SliSource(boost::function<void()> &triggerRedrawFunc)
     : triggerRedraw(triggerRedrawFunc) {
   threadQueue = ThreadPool::Queue::create();
+  pyramidCache = PyramidCache::create(PyramidCache::defaultDirectory());
 }
 
 SliSource::~SliSource() {}
@@ -22,6 +38,7 @@ void SliSource::computeHeightWidth() {
   auto rect = spannedRectangle(toggled, layers, true);
   total_width = rect.getWidth();
   total_height = rect.getHeight();
+  inkSums = InkSums::create(total_width, total_height);
 }
 
 void SliSource::checkXoffsets() {
@@ -56,42 +73,268 @@ bool SliSource::addLayer(std::string imagePath, std::string filename,
     return false;
   }
   layers.push_back(layer);
+  fileIdentities.push_back(identifyFiles(layer));
+  lastUsed.push_back(0);
+  imported.push_back(false);
+  importing.push_back(false);
+  streamed.push_back(false);
   return true;
 }
 
-void SliSource::importBitmaps() {
-  for (SliLayer::Ptr layer : layers) {
-    auto extension = layer->name.substr(layer->name.find_last_of("."));
-    boost::to_lower(extension);
+void SliSource::importBitmap(SliLayer::Ptr layer) {
+  auto extension = layer->name.substr(layer->name.find_last_of("."));
+  boost::to_lower(extension);
 
-    if (extension == ".sep") {
-      sepSources[layer]->fillSliLayerBitmap(layer);
-    } else {
-      layer->fillBitmapFromTiff();
+  if (extension == ".sep") {
+    sepSources[layer]->fillSliLayerBitmap(layer);
+    if (compressBitmaps)
+      layer->compressBitmap();
+    return;
+  }
+
+  LayerBitmapCache::getInstance().load(layer, [this](const SliLayer::Ptr &l) {
+    if (!mapBitmaps || !l->mapBitmapFromTiff())
+      l->fillBitmapFromTiff();
+
+    if (compressBitmaps)
+      l->compressBitmap();
+  });
+}
+
+void SliSource::importNext(boost::mutex::scoped_lock &lock) {
+  size_t index = importQueue.front();
+  importQueue.pop_front();
+
+  lock.unlock();
+  importBitmap(layers[index]);
+  lock.lock();
+
+  imported.set(index);
+  importing.reset(index);
+  importFinished.notify_all();
+
+  // Composite the layer as soon as possible, but bound the rate of redraws
+  // while layers keep coming in. The last import of the queue always does,
+  // so no layer is left waiting for one that never comes.
+  streamed.set(index);
+  bool due = importQueue.empty() ||
+             boost::posix_time::microsec_clock::universal_time() >=
+                 lastStreamRedraw +
+                     boost::posix_time::millisec(streamRedrawInterval);
+  if (due && !streamScheduled) {
+    streamScheduled = true;
+    CpuBound()->schedule(boost::bind(&SliSource::compositeImported,
+                                     shared_from_this<SliSource>()),
+                         PRIO_HIGHER, threadQueue);
+  }
+}
+
+void SliSource::importWorker() {
+  boost::mutex::scoped_lock lock(importMtx);
+  while (!importQueue.empty())
+    importNext(lock);
+  nImportWorkers--;
+}
+
+void SliSource::scheduleImports() {
+  while (nImportWorkers < importConcurrency &&
+         nImportWorkers < importQueue.size()) {
+    nImportWorkers++;
+    CpuBound()->schedule(
+        boost::bind(&SliSource::importWorker, shared_from_this<SliSource>()),
+        PRIO_HIGHER, threadQueue);
+  }
+}
+
+void SliSource::queueImports(const boost::dynamic_bitset<> &layerMask) {
+  boost::mutex::scoped_lock lock(importMtx);
+  for (size_t j = 0; j < layers.size(); j++) {
+    if (layerMask[j] && !imported[j] && !importing[j]) {
+      importing.set(j);
+      importQueue.push_back(j);
+    }
+  }
+  prioritizeImports();
+  scheduleImports();
+}
+
+void SliSource::prioritizeImports() {
+  std::stable_partition(importQueue.begin(), importQueue.end(), [&](size_t j) {
+    for (auto &view : viewAreas) {
+      if (layers[j]->toRectangle().intersects(view.second))
+        return true;
+    }
+    return false;
+  });
+}
+
+void SliSource::setViewArea(ViewInterface::WeakPtr view,
+                            Scroom::Utils::Rectangle<int> area, int zoom) {
+  boost::mutex::scoped_lock lock(importMtx);
+  viewAreas[view] = area;
+  viewZooms[view] = zoom;
+  prioritizeImports();
+}
+
+void SliSource::removeViewArea(ViewInterface::WeakPtr view) {
+  boost::mutex::scoped_lock lock(importMtx);
+  viewAreas.erase(view);
+  viewZooms.erase(view);
+}
+
+void SliSource::setColors(ColorTable::ConstPtr colors) {
+  CpuBound()->schedule(boost::bind(&SliSource::recolor,
+                                   shared_from_this<SliSource>(), colors),
+                       PRIO_HIGHER, threadQueue);
+}
+
+void SliSource::recolor(ColorTable::ConstPtr colors) {
+  boost::mutex::scoped_lock lock(mtx);
+  boost::dynamic_bitset<> recolored(layers.size());
+  for (size_t j = 0; j < layers.size(); j++) {
+    for (auto &channel : layers[j]->channels) {
+      // Colors that are no longer defined keep their old definition
+      CustomColor::Ptr color = colors->find(channel->name);
+      if (!color)
+        continue;
+      if (color->cMultiplier != channel->cMultiplier ||
+          color->mMultiplier != channel->mMultiplier ||
+          color->yMultiplier != channel->yMultiplier ||
+          color->kMultiplier != channel->kMultiplier)
+        recolored.set(j);
+      channel = color;
     }
   }
-  bitmapsImported = true;
+  if (recolored.none())
+    return;
+
+  memoizedStates.remove_if([&recolored](const MemoizedState &state) {
+    return state.visible.intersects(recolored);
+  });
+
+  // Like a toggle, but without changing which layers are visible
+  recolored &= visible;
+  if (recolored.none() || !rgbCache.count(0))
+    return;
+
+  auto area = spannedRectangle(recolored, layers);
+  bool wasClear = rgbCache[0]->clear;
+  rgbCache[0]->clearSurface(area);
+  rgbCache[0]->clear = wasClear;
+  compositeArea(area, recolored.find_first());
+  storePyramid();
+
+  lock.unlock();
+  triggerRedraw();
+}
+
+void SliSource::compositeImported() {
+  boost::mutex::scoped_lock lock(mtx);
+  boost::dynamic_bitset<> arrived;
+  {
+    boost::mutex::scoped_lock importLock(importMtx);
+    arrived = streamed;
+    streamed.reset();
+    streamScheduled = false;
+    lastStreamRedraw = boost::posix_time::microsec_clock::universal_time();
+  }
+
+  // Layers that aren't visible yet will be drawn by fillCache(), as will
+  // everything if the base surface does not exist yet
+  arrived &= visible;
+  if (arrived.none() || !rgbCache.count(0))
+    return;
+
+  auto area = spannedRectangle(arrived, layers);
+  bool wasClear = rgbCache[0]->clear;
+  rgbCache[0]->clearSurface(area);
+  rgbCache[0]->clear = wasClear;
+  compositeArea(area, arrived.find_first());
+  storePyramid();
+
+  lock.unlock();
   triggerRedraw();
 }
 
+void SliSource::waitForImports(const boost::dynamic_bitset<> &layerMask) {
+  queueImports(layerMask);
+
+  boost::mutex::scoped_lock lock(importMtx);
+  while (!layerMask.is_subset_of(imported)) {
+    if (!importQueue.empty())
+      importNext(lock);
+    else
+      importFinished.wait(lock);
+  }
+}
+
 void SliSource::queryImportBitmaps() {
-  CpuBound()->schedule(
-      boost::bind(&SliSource::importBitmaps, shared_from_this<SliSource>()),
-      PRIO_HIGHER, threadQueue);
+  // A cached pyramid makes the bitmaps unnecessary until a layer is toggled
+  auto mask = visible ^ toggled;
+  if (streamingRender ||
+      (pyramidCache && pyramidCache->contains(pyramidKey(mask))))
+    return;
+
+  queueImports(mask);
+}
+
+void SliSource::evictBitmaps() {
+  boost::mutex::scoped_lock lock(importMtx);
+  // Layers of the same file share their bitmap, which is only counted once
+  // and only freed once none of them holds it anymore
+  std::map<const void *, size_t> holders;
+  size_t used = 0;
+  for (auto &layer : layers) {
+    const void *id = layer->getBitmapId();
+    used += layer->getMipmapsSize();
+    if (id && holders[id]++ == 0)
+      used += layer->getBitmapSize() - layer->getMipmapsSize();
+  }
+
+  if (used <= bitmapMemoryBudget)
+    return;
+
+  std::vector<size_t> candidates;
+  for (size_t j = 0; j < layers.size(); j++) {
+    // Mapped bitmaps have no size, unmapping them would not gain anything
+    if (!visible[j] && imported[j] && layers[j]->getBitmapSize() > 0)
+      candidates.push_back(j);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [&](size_t a, size_t b) { return lastUsed[a] < lastUsed[b]; });
+
+  for (size_t j : candidates) {
+    if (used <= bitmapMemoryBudget)
+      break;
+    auto &layer = layers[j];
+    const void *id = layer->getBitmapId();
+    used -= layer->getMipmapsSize();
+    if (id && --holders[id] == 0)
+      used -= layer->getBitmapSize() - layer->getMipmapsSize();
+    layer->unloadBitmap();
+    imported.reset(j);
+  }
 }
 
 void SliSource::wipeCacheAndRedraw() {
-  clearBottomSurface();
-  getSurface(0); // recompute bottom surface and trigger redraw when ready
+  // Memoizing the current pixels is a large copy, so leave the clearing to
+  // the worker that recomputes the bottom surface and triggers the redraw
+  SliSource::Ptr self = shared_from_this<SliSource>();
+  CpuBound()->schedule(
+      [self]() {
+        self->clearBottomSurface();
+        self->fillCache();
+      },
+      PRIO_HIGHER, threadQueue);
 }
 
 SurfaceWrapper::Ptr SliSource::getSurface(int zoom) {
-  if (!bitmapsImported) {
-    return nullptr;
-  } else if (!rgbCache.count(std::min(0, zoom)) || rgbCache[0]->clear) {
-    CpuBound()->schedule(
-        boost::bind(&SliSource::fillCache, shared_from_this<SliSource>()),
-        PRIO_HIGHER, threadQueue);
+  if (!rgbCache.count(std::min(0, zoom)) || rgbCache[0]->clear) {
+    if (!fillPending.exchange(true)) {
+      CpuBound()->schedule(
+          boost::bind(&SliSource::fillCache, shared_from_this<SliSource>()),
+          PRIO_HIGHER, threadQueue);
+    }
     if (rgbCache.count(std::min(0, zoom))) {
       return rgbCache[std::min(0, zoom)];
     }
@@ -105,213 +348,391 @@ void SliSource::fillCache() {
   disableInteractions();
   visible ^= toggled;
 
-  if (!rgbCache.count(0) || rgbCache[0]->clear) {
-    computeRgb();
-
-    for (int i = -1; i >= -30; i--) {
-      // true -> uses multithreading
-      reduceRgb(i, true);
+  if ((!rgbCache.count(0) || rgbCache[0]->clear) && !loadPyramid()) {
+    // Going back to a recent state only needs a copy
+    auto area = spannedRectangle(toggled, layers);
+    if (rgbCache.count(0) && restoreState(area)) {
+      markCheckpointsStale(area, toggled.find_first());
+    } else {
+      compositePreviews();
+      computeRgb();
     }
+    storePyramid();
   }
+  evictBitmaps();
 
   rgbCache[0]->clear = false;
+  fillPending = false;
   toggled.reset();
   enableInteractions();
   mtx.unlock();
   triggerRedraw();
 }
 
-void SliSource::reduceSegments(SurfaceWrapper::Ptr targetSurface,
-                               boost::dynamic_bitset<> toggledSegments,
-                               int baseSegHeight, int zoom) {
-  for (int i = 0; i < static_cast<int>(toggledSegments.size()); i++) {
-    if (!toggledSegments[i])
-      continue;
+std::string SliSource::identifyFiles(SliLayer::Ptr layer) {
+  namespace fs = boost::filesystem;
 
-    const int sourceWidth = total_width / pow(2, -zoom - 1);
-    const int sourceOffset = (baseSegHeight / pow(2, -zoom - 1)) * i;
-    const int sourceStride = rgbCache[zoom + 1]->getStride();
-
-    int targetSegHeight;
-    if (i == static_cast<int>(toggledSegments.size()) - 1) {
-      // the last segment will probably have leftover pixels
-      int leftoverPixels = (total_height % baseSegHeight) / pow(2, -zoom);
-      targetSegHeight = (baseSegHeight / pow(2, -zoom)) + leftoverPixels;
-    } else {
-      targetSegHeight = baseSegHeight / pow(2, -zoom);
-    }
+  // The pixels of SEP layers come from the channel files it lists
+  std::vector<fs::path> files = {layer->filepath};
+  if (sepSources.count(layer)) {
+    for (auto &file : SepSource::parseSep(layer->filepath).files)
+      files.push_back(file.second);
+  }
 
-    const int targetWidth = sourceWidth / 2;
-    const int targetOffset = (baseSegHeight / pow(2, -zoom)) * i;
-    auto targetStride = targetSurface->getStride();
-    auto targetBitmap =
-        targetSurface->getBitmap() + targetOffset * targetStride;
-
-    for (int y = 0; y < targetSegHeight; y++) {
-      auto sourceBitmap1 = rgbCache[zoom + 1]->getBitmap() +
-                           2 * y * sourceStride + sourceOffset * sourceStride;
-      auto sourceBitmap2 = sourceBitmap1 + sourceStride;
-
-      for (int x = 0; x < targetWidth; x++) {
-        targetBitmap[0] = (sourceBitmap1[0] + sourceBitmap1[4] +
-                           sourceBitmap2[0] + sourceBitmap2[4]) /
-                          4;
-        targetBitmap[1] = (sourceBitmap1[1] + sourceBitmap1[5] +
-                           sourceBitmap2[1] + sourceBitmap2[5]) /
-                          4;
-        targetBitmap[2] = (sourceBitmap1[2] + sourceBitmap1[6] +
-                           sourceBitmap2[2] + sourceBitmap2[6]) /
-                          4;
-        targetBitmap[3] = (sourceBitmap1[3] + sourceBitmap1[7] +
-                           sourceBitmap2[3] + sourceBitmap2[7]) /
-                          4;
-
-        targetBitmap += 4;
-        sourceBitmap1 += 8;
-        sourceBitmap2 += 8;
-      }
-    }
+  std::ostringstream identity;
+  for (auto &file : files) {
+    boost::system::error_code ec;
+    auto path = fs::canonical(file, ec);
+    auto size = ec ? 0 : fs::file_size(path, ec);
+    auto mtime = ec ? 0 : fs::last_write_time(path, ec);
+    identity << " " << path.string() << ":" << size << ":" << mtime;
   }
+  return identity.str();
 }
 
-void SliSource::reduceRgb(int zoom, bool multithreading) {
-  // the total width of the reduced image
-  const int totalTargetWidth = total_width / pow(2, -zoom);
-  // the total height of the reduced image
-  const int totalTargetHeight = total_height / pow(2, -zoom);
+std::string SliSource::pyramidKey(const boost::dynamic_bitset<> &mask) {
+  std::ostringstream key;
+  key << std::setprecision(9) << total_width << "x" << total_height << "\n";
+  for (size_t i = 0; i < layers.size(); i++) {
+    if (!mask[i])
+      continue;
 
-  // create a new surface for this zoom level, unless it already exists
-  SurfaceWrapper::Ptr targetSurface = SurfaceWrapper::create();
-  if (rgbCache.count(zoom)) {
-    targetSurface = rgbCache[zoom];
-  } else {
-    targetSurface = SurfaceWrapper::create(totalTargetWidth, totalTargetHeight,
-                                           CAIRO_FORMAT_ARGB32);
-  }
-
-  unsigned int nSegments = 24; // just an arbitrary choice
-  int baseSegHeight = findBestSegFit(nSegments, total_height);
-  nSegments = static_cast<unsigned int>(total_height / baseSegHeight);
-  boost::dynamic_bitset<> toggledSegments{nSegments};
-  auto spanRect = spannedRectangle(toggled, layers);
-
-  // find which segments intersect with the rectangle spanned by the toggled
-  // layers
-  int n = 0;
-  for (int i = 0; i < static_cast<int>(nSegments); i++) {
-    Scroom::Utils::Rectangle<int> seg = {0, baseSegHeight * i, total_width,
-                                         baseSegHeight};
-    if (seg.intersects(spanRect)) {
-      toggledSegments.set(i);
-      n++;
+    auto &layer = layers[i];
+    key << i << ": " << layer->xoffset << "," << layer->yoffset << " "
+        << layer->width << "x" << layer->height << fileIdentities[i];
+
+    for (auto &channel : layer->channels) {
+      key << " " << channel->name << "=" << channel->cMultiplier << ","
+          << channel->mMultiplier << "," << channel->yMultiplier << ","
+          << channel->kMultiplier;
     }
+    key << "\n";
   }
+  return key.str();
+}
+
+bool SliSource::loadPyramid() {
+  if (!pyramidCache)
+    return false;
 
-  // since all segments are disjoint, we can assign one thread to cover half of
-  // them
-  if (multithreading && (n / static_cast<double>(nSegments)) >= 0.25) {
-    auto bitmask = halfSegBitmask(toggledSegments);
-    auto toggledSegments1 = toggledSegments & bitmask;
-    auto toggledSegments2 = toggledSegments & ~bitmask;
-    boost::thread thread(
-        boost::bind(&SliSource::reduceSegments, shared_from_this<SliSource>(),
-                    targetSurface, toggledSegments2, baseSegHeight, zoom));
+  auto levels = pyramidCache->load(pyramidKey(visible));
+  if (!levels.count(0) || levels[0]->getWidth() != total_width ||
+      levels[0]->getHeight() != total_height)
+    return false;
 
-    // reduce the segments and copy them over to the targetSurface
-    reduceSegments(targetSurface, toggledSegments1, baseSegHeight, zoom);
+  for (auto &level : levels)
+    rgbCache[level.first] = level.second;
+  markCheckpointsStale(rgbCache[0]->toRectangle(), 0);
+  updateInkSums(rgbCache[0]->toRectangle());
+  return true;
+}
 
-    thread.join();
-  } else {
-    reduceSegments(targetSurface, toggledSegments, baseSegHeight, zoom);
+void SliSource::storePyramid() {
+  if (!pyramidCache || !rgbCache.count(0))
+    return;
+
+  {
+    boost::mutex::scoped_lock lock(importMtx);
+    // Layers that are still missing would be missing from the cache as well
+    if (!isComplete())
+      return;
+  }
+
+  auto key = pyramidKey(visible);
+  if (pyramidStorePending || pyramidCache->contains(key) ||
+      !pyramidCache->fits(key, rgbCache))
+    return;
+
+  // Writing the pyramid takes long, so it is done in the background from a
+  // copy, leaving the surfaces free to change meanwhile
+  std::map<int, SurfaceWrapper::Ptr> snapshot;
+  for (auto &level : rgbCache) {
+    auto &surface = level.second;
+    cairo_surface_flush(surface->surface);
+    auto copy = SurfaceWrapper::create(surface->getWidth(),
+                                       surface->getHeight(),
+                                       CAIRO_FORMAT_ARGB32);
+    copyRows(copy->getBitmap(), copy->getStride(), surface->getBitmap(),
+             surface->getStride(), surface->getWidth() * 4,
+             surface->getHeight());
+    cairo_surface_mark_dirty(copy->surface);
+    snapshot[level.first] = copy;
   }
 
-  if (!rgbCache.count(zoom))
-    rgbCache[zoom] = targetSurface;
+  pyramidStorePending = true;
+  PyramidCache::Ptr cache = pyramidCache;
+  boost::weak_ptr<SliSource> weak = shared_from_this<SliSource>();
+  CpuBound()->schedule(
+      [weak, cache, key, snapshot]() {
+        cache->store(key, snapshot);
+        if (SliSource::Ptr source = weak.lock())
+          source->pyramidStorePending = false;
+      },
+      PRIO_LOWEST, threadQueue);
 }
 
-void SliSource::convertCmykXoffset(uint8_t *surfacePointer,
-                                   uint32_t *targetPointer, int topLeftOffset,
-                                   int bottomRightOffset, int toggledWidth,
-                                   int toggledBound, int stride) {
-  double black;
-  uint8_t C, M, Y, K, A, R, G, B;
+bool SliSource::isComplete() {
+  // When streaming, every layer is drawn right away
+  return streamingRender ||
+         (visible.is_subset_of(imported) && !visible.intersects(streamed));
+}
+
+void SliSource::memoizeState(Scroom::Utils::Rectangle<int> area) {
+  if (!rgbCache.count(0) || rgbCache[0]->clear)
+    return;
+  {
+    boost::mutex::scoped_lock importLock(importMtx);
+    if (!isComplete())
+      return;
+  }
+
+  auto surface = rgbCache[0];
+  area = area.intersection(surface->toRectangle());
+  size_t rowBytes = static_cast<size_t>(area.getWidth()) * 4;
+  size_t bytes = rowBytes * std::max(0, area.getHeight());
+  if (bytes == 0 || bytes > stateMemoryBudget)
+    return;
+
+  // States of the same layers over a smaller area are superseded, and the
+  // least recently used ones make room for the new one. The pixels of one
+  // of them are reused rather than allocated again.
+  std::vector<uint8_t> pixels;
+  size_t used = bytes;
+  for (auto it = memoizedStates.begin(); it != memoizedStates.end();) {
+    bool superseded = it->visible == visible && area.contains(it->area);
+    if (!superseded && used + it->pixels.size() <= stateMemoryBudget) {
+      used += it->pixels.size();
+      ++it;
+      continue;
+    }
+    if (pixels.capacity() < bytes)
+      pixels.swap(it->pixels);
+    it = memoizedStates.erase(it);
+  }
+  pixels.resize(bytes);
 
-  for (int i = topLeftOffset; i < bottomRightOffset;) {
-    C = surfacePointer[i + 0];
-    M = surfacePointer[i + 1];
-    Y = surfacePointer[i + 2];
-    K = surfacePointer[i + 3];
+  MemoizedState state{visible, area, std::move(pixels)};
+  cairo_surface_flush(surface->surface);
+  const int stride = surface->getStride();
+  for (int y = 0; y < area.getHeight(); y++) {
+    memcpy(state.pixels.data() + y * rowBytes,
+           surface->getBitmap() + (area.getTop() + y) * stride +
+               area.getLeft() * 4,
+           rowBytes);
+  }
+  memoizedStates.push_front(std::move(state));
+}
 
-    black = (1 - K / 255.0);
-    A = 255;
-    R = 255 * (1 - C / 255.0) * black;
-    G = 255 * (1 - M / 255.0) * black;
-    B = 255 * (1 - Y / 255.0) * black;
+bool SliSource::restoreState(Scroom::Utils::Rectangle<int> area) {
+  auto surface = rgbCache[0];
+  area = area.intersection(surface->toRectangle());
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return false;
 
-    targetPointer[i / 4] = (A << 24) | (R << 16) | (G << 8) | B;
-    i += 4; // SPP = 4
+  for (auto it = memoizedStates.begin(); it != memoizedStates.end(); ++it) {
+    if (it->visible != visible || !it->area.contains(area))
+      continue;
 
-    // we are past the image bounds; go to the next next line
-    if (i % stride == toggledBound) {
-      i += stride - toggledWidth;
+    size_t rowBytes = static_cast<size_t>(area.getWidth()) * 4;
+    size_t stateStride = static_cast<size_t>(it->area.getWidth()) * 4;
+    const uint8_t *source =
+        it->pixels.data() + (area.getTop() - it->area.getTop()) * stateStride +
+        (area.getLeft() - it->area.getLeft()) * 4;
+    const int stride = surface->getStride();
+    cairo_surface_flush(surface->surface);
+    for (int y = 0; y < area.getHeight(); y++) {
+      memcpy(surface->getBitmap() + (area.getTop() + y) * stride +
+                 area.getLeft() * 4,
+             source + y * stateStride, rowBytes);
     }
+    cairo_surface_mark_dirty(surface->surface);
+
+    memoizedStates.splice(memoizedStates.begin(), memoizedStates, it);
+    updateInkSums(area);
+    reducePyramid(area, true);
+    return true;
   }
+  return false;
 }
 
-void SliSource::convertCmyk(uint8_t *surfacePointer, uint32_t *targetPointer,
-                            int topLeftOffset, int bottomRightOffset) {
-  double black;
-  uint8_t C, M, Y, K, A, R, G, B;
+void SliSource::reducePyramid(Scroom::Utils::Rectangle<int> area,
+                              bool multithreading) {
+  // create the surfaces of the zoom levels that don't exist yet
+  for (int zoom = -1; zoom >= -30; zoom--) {
+    if (!rgbCache.count(zoom)) {
+      rgbCache[zoom] = SurfaceWrapper::create(
+          total_width >> -zoom, total_height >> -zoom, CAIRO_FORMAT_ARGB32);
+    }
+  }
 
-  for (int i = topLeftOffset; i < bottomRightOffset; i += 4) // SPP = 4
-  {
-    C = surfacePointer[i + 0];
-    M = surfacePointer[i + 1];
-    Y = surfacePointer[i + 2];
-    K = surfacePointer[i + 3];
+  area = area.intersection(rgbCache[0]->toRectangle());
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return;
 
-    black = (1 - K / 255.0);
-    A = 255;
-    R = 255 * (1 - C / 255.0) * black;
-    G = 255 * (1 - M / 255.0) * black;
-    B = 255 * (1 - Y / 255.0) * black;
+  // Below this level, rows depend on both halves of a split area
+  const int splitLevels = 10;
+  const int splitRows = 1 << splitLevels;
+  int split = (area.getTop() + area.getHeight() / 2) / splitRows * splitRows;
 
-    targetPointer[i / 4] = (A << 24) | (R << 16) | (G << 8) | B;
+  // Only worth a thread if a large part of the surface changed
+  if (!multithreading || 4 * area.getHeight() < total_height ||
+      split - area.getTop() < splitRows ||
+      area.getBottom() - split < splitRows) {
+    reduceLevels(0, -30, area);
+    return;
   }
+
+  // Both halves are aligned to splitRows, so they are independent down to
+  // level -splitLevels
+  Scroom::Utils::Rectangle<int> top{area.getLeft(), area.getTop(),
+                                    area.getWidth(), split - area.getTop()};
+  Scroom::Utils::Rectangle<int> bottom{area.getLeft(), split, area.getWidth(),
+                                       area.getBottom() - split};
+  boost::thread thread(boost::bind(&SliSource::reduceLevels,
+                                   shared_from_this<SliSource>(), 0,
+                                   -splitLevels, bottom));
+  reduceLevels(0, -splitLevels, top);
+  thread.join();
+
+  // The remaining levels are small, finish them from level -splitLevels
+  int left = area.getLeft() >> splitLevels;
+  int right = ((area.getRight() - 1) >> splitLevels) + 1;
+  int first = area.getTop() >> splitLevels;
+  int last = ((area.getBottom() - 1) >> splitLevels) + 1;
+  reduceLevels(-splitLevels, -30, {left, first, right - left, last - first});
 }
 
-void SliSource::drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
-                         int bitmapStart, int bitmapOffset,
-                         SliLayer::Ptr layer) {
+void SliSource::reduceBands(
+    std::vector<Scroom::Utils::Rectangle<int>> bands) {
+  std::sort(bands.begin(), bands.end(),
+            [](const Scroom::Utils::Rectangle<int> &a,
+               const Scroom::Utils::Rectangle<int> &b) {
+              return a.getTop() < b.getTop();
+            });
+  for (size_t i = 0; i < bands.size();) {
+    Scroom::Utils::Rectangle<int> run = bands[i];
+    for (i++; i < bands.size() && bands[i].getTop() == run.getBottom(); i++)
+      run = {run.getLeft(), run.getTop(), run.getWidth(),
+             bands[i].getBottom() - run.getTop()};
+    reducePyramid(run, true);
+  }
+}
 
-  for (int i = bitmapStart; i < bitmapStart + bitmapOffset;
-       i += layer->spp) {        // Iterate over all pixels
-    int16_t C = *surfacePointer; // Initialize the CMYK holder values to the
-                                 // current values for their color
-    int16_t M = *(surfacePointer + 1);
-    int16_t Y = *(surfacePointer + 2);
-    int16_t K = *(surfacePointer + 3);
-    for (uint16_t j = 0; j < layer->spp;
-         j++) { // Add values to the 32bit cmyk holders
-      auto &color = layer->channels.at(j);
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, bitmap[i + j]);
+void SliSource::reduceLevels(int sourceZoom, int lastZoom,
+                             Scroom::Utils::Rectangle<int> area) {
+  const int nLevels = sourceZoom - lastZoom;
+
+  // The rows and columns (inclusive) that change on every level, starting at
+  // sourceZoom
+  std::vector<int> firstRow(nLevels + 1), lastRow(nLevels + 1);
+  std::vector<int> firstColumn(nLevels + 1), lastColumn(nLevels + 1);
+  firstRow[0] = area.getTop();
+  lastRow[0] = area.getBottom() - 1;
+  firstColumn[0] = area.getLeft();
+  lastColumn[0] = area.getRight() - 1;
+  for (int level = 1; level <= nLevels; level++) {
+    auto surface = rgbCache[sourceZoom - level];
+    firstRow[level] = firstRow[level - 1] / 2;
+    lastRow[level] = std::min(lastRow[level - 1] / 2, surface->getHeight() - 1);
+    firstColumn[level] = firstColumn[level - 1] / 2;
+    lastColumn[level] =
+        std::min(lastColumn[level - 1] / 2, surface->getWidth() - 1);
+  }
+
+  for (int y = firstRow[1]; y <= lastRow[1]; y++) {
+    reduceRow(sourceZoom - 1, y, firstColumn[1], lastColumn[1]);
+
+    // Carry on down the pyramid as long as this row completes a row of the
+    // next level. The last row of the area completes its row regardless, its
+    // neighbour didn't change.
+    int row = y;
+    for (int level = 2; level <= nLevels; level++) {
+      if (row % 2 == 0 && row != lastRow[level - 1])
+        break;
+      row /= 2;
+      if (row > lastRow[level])
+        break;
+      reduceRow(sourceZoom - level, row, firstColumn[level], lastColumn[level]);
     }
-    // Store the CMYK values back into the surface, clipped to uint_8
-    *surfacePointer = CustomColorHelpers::toUint8(C);
-    *(surfacePointer + 1) = CustomColorHelpers::toUint8(M);
-    *(surfacePointer + 2) = CustomColorHelpers::toUint8(Y);
-    *(surfacePointer + 3) = CustomColorHelpers::toUint8(K);
+  }
+}
 
-    surfacePointer += 4; // Advance the pointer
+void SliSource::reduceRow(int zoom, int y, int firstColumn, int lastColumn) {
+  auto &source = rgbCache[zoom + 1];
+  auto &target = rgbCache[zoom];
+  const int sourceStride = source->getStride();
+
+  auto targetBitmap =
+      target->getBitmap() + y * target->getStride() + firstColumn * 4;
+  auto sourceBitmap1 =
+      source->getBitmap() + 2 * y * sourceStride + 2 * firstColumn * 4;
+  auto sourceBitmap2 = sourceBitmap1 + sourceStride;
+
+  for (int x = firstColumn; x <= lastColumn; x++) {
+    targetBitmap[0] = (sourceBitmap1[0] + sourceBitmap1[4] + sourceBitmap2[0] +
+                       sourceBitmap2[4]) /
+                      4;
+    targetBitmap[1] = (sourceBitmap1[1] + sourceBitmap1[5] + sourceBitmap2[1] +
+                       sourceBitmap2[5]) /
+                      4;
+    targetBitmap[2] = (sourceBitmap1[2] + sourceBitmap1[6] + sourceBitmap2[2] +
+                       sourceBitmap2[6]) /
+                      4;
+    targetBitmap[3] = (sourceBitmap1[3] + sourceBitmap1[7] + sourceBitmap2[3] +
+                       sourceBitmap2[7]) /
+                      4;
+
+    targetBitmap += 4;
+    sourceBitmap1 += 8;
+    sourceBitmap2 += 8;
   }
 }
 
-void SliSource::drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
+void SliSource::convertCmyk(const uint8_t *cmyk, int cmykStride,
+                            uint32_t *targetPointer, int targetStride,
+                            int width, int height) {
+  double black;
+  uint8_t C, M, Y, K, A, R, G, B;
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t *source = cmyk + y * cmykStride;
+    uint32_t *target = reinterpret_cast<uint32_t *>(
+        reinterpret_cast<uint8_t *>(targetPointer) + y * targetStride);
+
+    for (int x = 0; x < width; x++) {
+      C = source[0];
+      M = source[1];
+      Y = source[2];
+      K = source[3];
+
+      black = (1 - K / 255.0);
+      A = 255;
+      R = 255 * (1 - C / 255.0) * black;
+      G = 255 * (1 - M / 255.0) * black;
+      B = 255 * (1 - Y / 255.0) * black;
+
+      target[x] = (A << 24) | (R << 16) | (G << 8) | B;
+      source += 4; // SPP = 4
+    }
+  }
+}
+
+void SliSource::drawCmyk(uint8_t *surfacePointer, const uint8_t *bitmap,
+                         int bitmapStart, int bitmapOffset,
+                         SliLayer::Ptr layer) {
+  // Add the CMYK values of all pixels to those already in the surface
+  layer->getColorTransform()->apply(bitmap + bitmapStart, surfacePointer,
+                                    bitmapOffset / layer->spp);
+}
+
+void SliSource::drawCmykXoffset(uint8_t *surfacePointer,
+                                const uint8_t *bitmap,
                                 int bitmapStart, int bitmapOffset,
                                 Scroom::Utils::Rectangle<int> layerRect,
                                 Scroom::Utils::Rectangle<int> intersectRect,
                                 int layerBound, int stride,
                                 SliLayer::Ptr layer) {
+  ColorTransform::Ptr transform = layer->getColorTransform();
   for (int i = bitmapStart; i < bitmapStart + bitmapOffset;) {
     int k = i;
     std::vector<uint8_t *> addresses = {};
@@ -340,17 +761,14 @@ void SliSource::drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
     advanceIAndSurfacePointer(layerRect, intersectRect, layerBound, stride,
                               surfacePointer, k);
 
-    for (uint16_t j = 0; j < layer->spp;
-         j++) { // Add values to the 32bit cmyk holders
-      auto color = layer->channels.at(j);
-      CustomColorHelpers::calculateCMYK(color, C, M, Y, K, bitmap[i + j]);
-    }
+    int32_t cmyk[4] = {C, M, Y, K};
+    transform->addPixel(bitmap + i, cmyk);
     // Write the CMYK values back to the surface, clipped to uint_8
 
-    *(addresses.at(0)) = CustomColorHelpers::toUint8(C);
-    *(addresses.at(1)) = CustomColorHelpers::toUint8(M);
-    *(addresses.at(2)) = CustomColorHelpers::toUint8(Y);
-    *(addresses.at(3)) = CustomColorHelpers::toUint8(K);
+    *(addresses.at(0)) = ColorTransform::clip(cmyk[0]);
+    *(addresses.at(1)) = ColorTransform::clip(cmyk[1]);
+    *(addresses.at(2)) = ColorTransform::clip(cmyk[2]);
+    *(addresses.at(3)) = ColorTransform::clip(cmyk[3]);
     // set i to the incremented value
     i = k;
   }
@@ -370,83 +788,531 @@ void SliSource::advanceIAndSurfacePointer(
 }
 
 void SliSource::computeRgb() {
+  if (toggled.none() && rgbCache.count(0))
+    return;
+
+  compositeArea(spannedRectangle(toggled, layers), toggled.find_first());
+}
+
+size_t SliSource::sortBandsByViews(
+    std::vector<Scroom::Utils::Rectangle<int>> &bands) {
+  std::vector<Scroom::Utils::Rectangle<int>> areas;
+  {
+    boost::mutex::scoped_lock lock(importMtx);
+    for (auto &view : viewAreas)
+      areas.push_back(view.second);
+  }
+  if (areas.empty())
+    return 0;
+
+  // 0 for bands in view, otherwise 1 + the number of pixels between the band
+  // and the nearest view, in either direction
+  auto distance = [&areas](const Scroom::Utils::Rectangle<int> &band) {
+    int nearest = std::numeric_limits<int>::max();
+    for (auto &area : areas) {
+      if (band.intersects(area))
+        return 0;
+      int dx = std::max({0, area.getLeft() - band.getRight(),
+                         band.getLeft() - area.getRight()});
+      int dy = std::max({0, area.getTop() - band.getBottom(),
+                         band.getTop() - area.getBottom()});
+      nearest = std::min(nearest, 1 + std::max(dx, dy));
+    }
+    return nearest;
+  };
+
+  std::vector<std::pair<int, Scroom::Utils::Rectangle<int>>> sorted;
+  size_t inView = 0;
+  for (auto &band : bands) {
+    sorted.emplace_back(distance(band), band);
+    if (sorted.back().first == 0)
+      inView++;
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<int, Scroom::Utils::Rectangle<int>> &a,
+                      const std::pair<int, Scroom::Utils::Rectangle<int>> &b) {
+                     return a.first < b.first;
+                   });
+  for (size_t i = 0; i < bands.size(); i++)
+    bands[i] = sorted[i].second;
+  return inView;
+}
+
+void SliSource::compositePreviews() {
+  if (previewZoom >= 0 || streamingRender || !rgbCache.count(0) ||
+      toggled.none())
+    return;
+
+  std::map<ViewInterface::WeakPtr, Scroom::Utils::Rectangle<int>> areas;
+  std::map<ViewInterface::WeakPtr, int> zooms;
+  {
+    boost::mutex::scoped_lock lock(importMtx);
+    areas = viewAreas;
+    zooms = viewZooms;
+  }
+
+  auto toggledArea = spannedRectangle(toggled, layers);
+  bool drawn = false;
+  for (auto &view : areas) {
+    int zoom = std::max(-30, zooms[view.first]);
+    auto area = view.second.intersection(toggledArea);
+    if (zoom > previewZoom || area.getWidth() <= 0 || area.getHeight() <= 0)
+      continue;
+    compositePreview(zoom, area);
+    drawn = true;
+  }
+  if (drawn)
+    triggerRedraw();
+}
+
+void SliSource::compositePreview(int zoom,
+                                 Scroom::Utils::Rectangle<int> area) {
+  const int k = -zoom;
+  auto surface = rgbCache[zoom];
+  int left = area.getLeft() >> k;
+  int top = area.getTop() >> k;
+  Scroom::Utils::Rectangle<int> rect{
+      left, top, ((area.getRight() - 1) >> k) + 1 - left,
+      ((area.getBottom() - 1) >> k) + 1 - top};
+  rect = rect.intersection(surface->toRectangle());
+  if (rect.getWidth() <= 0 || rect.getHeight() <= 0)
+    return;
+
+  boost::dynamic_bitset<> drawable;
+  {
+    boost::mutex::scoped_lock lock(importMtx);
+    drawable = visible & imported;
+  }
+
+  const int stride = rect.getWidth() * 4;
+  std::vector<uint8_t> cmyk(static_cast<size_t>(stride) * rect.getHeight());
+  for (size_t j = 0; j < layers.size(); j++) {
+    if (!drawable[j])
+      continue;
+
+    auto &layer = layers[j];
+    const LayerMipmap &mipmap = layer->getMipmap(zoom);
+    auto intersect = mipmap.rect.intersection(rect);
+    if (intersect.getWidth() <= 0 || intersect.getHeight() <= 0)
+      continue;
+
+    // Draw row by row, the mipmap is narrower than the area of the view
+    const int mipmapStride = mipmap.rect.getWidth() * layer->spp;
+    for (int y = intersect.getTop(); y < intersect.getBottom(); y++) {
+      drawCmyk(cmyk.data() + (y - rect.getTop()) * stride +
+                   (intersect.getLeft() - rect.getLeft()) * 4,
+               mipmap.data.data() + (y - mipmap.rect.getTop()) * mipmapStride,
+               (intersect.getLeft() - mipmap.rect.getLeft()) * layer->spp,
+               intersect.getWidth() * layer->spp, layer);
+    }
+  }
+
+  cairo_surface_flush(surface->surface);
+  const int targetStride = surface->getStride();
+  uint8_t *targetBegin = surface->getBitmap() +
+                         pointToOffset(toBytesRectangle(rect).getTopLeft(),
+                                       targetStride);
+  convertCmyk(cmyk.data(), stride, reinterpret_cast<uint32_t *>(targetBegin),
+              targetStride, rect.getWidth(), rect.getHeight());
+  cairo_surface_mark_dirty(surface->surface);
+
+  if (zoom > -30)
+    reduceLevels(zoom, -30, rect);
+}
+
+void SliSource::updateInkSums(Scroom::Utils::Rectangle<int> area) {
+  if (inkSums)
+    inkSums->update(rgbCache[0]->getBitmap(), rgbCache[0]->getStride(), area);
+}
+
+InkSums::Sum SliSource::getInkSums(Scroom::Utils::Rectangle<int> area) {
+  if (!inkSums || !rgbCache.count(0))
+    return {};
+  auto surface = rgbCache[0];
+  return inkSums->getSum(surface->getBitmap(), surface->getStride(), area);
+}
+
+void SliSource::updateLayerIndex() {
+  std::vector<Scroom::Utils::Rectangle<int>> rects;
+  for (auto &layer : layers)
+    rects.push_back(toBytesRectangle(layer->toRectangle(), layer->spp));
+  layerIndex = LayerIndex::create(rects);
+}
+
+void SliSource::createCheckpoints() {
+  checkpointsCreated = true;
+  if (checkpointInterval <= 0 || streamingRender || layers.size() < 2)
+    return;
+
+  size_t bytes = static_cast<size_t>(total_width) * total_height * 4;
+  size_t count = (layers.size() - 1) / checkpointInterval;
+  if (bytes > 0)
+    count = std::min(count, checkpointMemoryBudget / bytes);
+
+  // Spread evenly over the layers, so no layer is far above a checkpoint.
+  // Nothing has been saved in them yet.
+  auto stale = checkpointTiles({0, 0, total_width, total_height});
+  for (size_t i = 1; i <= count; i++) {
+    checkpoints.push_back(
+        {i * layers.size() / (count + 1), std::vector<uint8_t>(bytes), stale});
+  }
+}
+
+boost::dynamic_bitset<>
+SliSource::checkpointTiles(Scroom::Utils::Rectangle<int> area) {
+  const int size = CompositeCheckpoint::TILE_SIZE;
+  const int columns = (total_width + size - 1) / size;
+  const int rows = (total_height + size - 1) / size;
+  boost::dynamic_bitset<> tiles{static_cast<size_t>(columns * rows)};
+
+  area = area.intersection({0, 0, total_width, total_height});
+  if (area.getWidth() <= 0 || area.getHeight() <= 0)
+    return tiles;
+  for (int y = area.getTop() / size; y <= (area.getBottom() - 1) / size; y++) {
+    for (int x = area.getLeft() / size; x <= (area.getRight() - 1) / size;
+         x++)
+      tiles.set(y * columns + x);
+  }
+  return tiles;
+}
+
+int SliSource::findCheckpoint(Scroom::Utils::Rectangle<int> area,
+                              size_t firstChanged) {
+  auto tiles = checkpointTiles(area);
+  for (int k = static_cast<int>(checkpoints.size()) - 1; k >= 0; k--) {
+    if (checkpoints[k].layer <= firstChanged &&
+        !checkpoints[k].stale.intersects(tiles))
+      return k;
+  }
+  return -1;
+}
+
+void SliSource::markCheckpointsStale(Scroom::Utils::Rectangle<int> area,
+                                     size_t firstChanged) {
+  if (checkpoints.empty())
+    return;
+
+  auto tiles = checkpointTiles(area);
+  for (auto &checkpoint : checkpoints) {
+    if (checkpoint.layer > firstChanged)
+      checkpoint.stale |= tiles;
+  }
+}
+
+void SliSource::compositeArea(Scroom::Utils::Rectangle<int> area,
+                              size_t firstChanged) {
   SurfaceWrapper::Ptr surface = SurfaceWrapper::create();
 
   // Check if cache surface exists first
   if (rgbCache.count(0)) {
     surface = rgbCache[0];
+  } else if (streamingRender) {
+    surface = SurfaceWrapper::createFileBacked(total_width, total_height);
   } else {
     surface =
         SurfaceWrapper::create(total_width, total_height, CAIRO_FORMAT_ARGB32);
   }
-  const int stride = surface->getStride();
+  rgbCache[0] = surface;
   cairo_surface_flush(surface->surface);
-  uint8_t *surfaceBegin = cairo_image_surface_get_data(surface->surface);
-  uint32_t *targetBegin = reinterpret_cast<uint32_t *>(surfaceBegin);
-  uint8_t *currentSurfaceByte = surfaceBegin;
 
-  // Rectangle (in bytes) of the toggled area
-  Scroom::Utils::Rectangle<int> toggledRect =
-      toBytesRectangle(spannedRectangle(toggled, layers));
+  if (!checkpointsCreated)
+    createCheckpoints();
+
+  // Compositing overwrites the whole area, so it can as well cover whole
+  // checkpoint tiles, which then become up to date
+  if (!checkpoints.empty() && area.getWidth() > 0 && area.getHeight() > 0) {
+    const int size = CompositeCheckpoint::TILE_SIZE;
+    int left = area.getLeft() / size * size;
+    int top = area.getTop() / size * size;
+    int right =
+        std::min(total_width, (area.getRight() + size - 1) / size * size);
+    int bottom =
+        std::min(total_height, (area.getBottom() + size - 1) / size * size);
+    area = {left, top, right - left, bottom - top};
+  }
+
+  // Rectangle (in bytes) of the area to composite
+  Scroom::Utils::Rectangle<int> toggledRect = toBytesRectangle(area);
+
+  if (!layerIndex || layerIndex->size() != layers.size())
+    updateLayerIndex();
+
+  boost::dynamic_bitset<> needed{layers.size()};
+  for (size_t j : layerIndex->query(toggledRect)) {
+    if (visible[j])
+      needed.set(j);
+  }
+
+  // Only draw the layers that have been imported already. The others are
+  // queued, and streamed in by compositeImported() once they arrive. When
+  // streaming, the layers are read from disk band by band instead.
+  boost::dynamic_bitset<> drawable = needed;
+  if (!streamingRender) {
+    queueImports(needed);
+    boost::mutex::scoped_lock lock(importMtx);
+    drawable &= imported;
+  }
+
+  nCompositions++;
+  for (size_t j = 0; j < layers.size(); j++) {
+    if (drawable[j])
+      lastUsed[j] = nCompositions;
+  }
+
+  // Start from the checkpoint below the lowest changed layer. The ones above
+  // it are refreshed on the way, unless a layer below them is still missing.
+  int start = findCheckpoint(area, firstChanged);
+  boost::dynamic_bitset<> missing = needed - drawable;
+  size_t firstMissing = missing.find_first();
+  int end = start + 1;
+  while (end < static_cast<int>(checkpoints.size()) &&
+         checkpoints[end].layer <= firstMissing)
+    end++;
+
+  // Bands are sized to stay in the CPU cache while they are composited and
+  // converted. When streaming, only one band of every layer is held in memory
+  // at a time, so there they are sized to make reading from disk efficient.
+  int bandRows = streamBandRows;
+  if (!streamingRender) {
+    int rowBytes = std::max(1, area.getWidth() * 4);
+    int tiles = compositeBandBytes / rowBytes / RleBitmap::TILE_ROWS;
+    bandRows = std::max(1, tiles) * RleBitmap::TILE_ROWS;
+  }
+  auto bands = boost::make_shared<BandQueue>();
+  for (int top = area.getTop(); top < area.getBottom(); top += bandRows) {
+    bands->bands.push_back({area.getLeft(), top, area.getWidth(),
+                            std::min(bandRows, area.getBottom() - top)});
+  }
+
+  // Once the bands in view are done, they are shown while the others are
+  // composited
+  size_t inView = sortBandsByViews(bands->bands);
+  if (inView == bands->bands.size())
+    inView = 0;
+
+  if (streamingRender) {
+    // Layers are read from disk through shared file handles, so one at a time
+    for (size_t i = 0; i < bands->bands.size(); i++) {
+      compositeBand(surface, bands->bands[i], drawable, start, end);
+      // Reduce each band as soon as it is done, while it is still cached
+      reducePyramid(bands->bands[i], false);
+      if (i + 1 == inView) {
+        cairo_surface_mark_dirty(surface->surface);
+        triggerRedraw();
+      }
+    }
+  } else {
+    if (inView > 0) {
+      auto first = boost::make_shared<BandQueue>();
+      first->bands.assign(bands->bands.begin(),
+                          bands->bands.begin() + inView);
+      bands->bands.erase(bands->bands.begin(), bands->bands.begin() + inView);
+      compositeBands(surface, first, drawable, start, end);
+      cairo_surface_mark_dirty(surface->surface);
+      reduceBands(first->bands);
+      triggerRedraw();
+    }
+    compositeBands(surface, bands, drawable, start, end);
+  }
+
+  if (start + 1 < end) {
+    auto tiles = checkpointTiles(area);
+    for (int k = start + 1; k < end; k++)
+      checkpoints[k].stale -= tiles;
+  }
+  markCheckpointsStale(area, firstMissing);
+
+  cairo_surface_mark_dirty(surface->surface);
+  updateInkSums(area);
 
-  for (size_t j = 0; j < layers.size(); j++) { // For every layer
-    if (!visible[j])
+  // The bands in view have been reduced already, as have all bands when
+  // streaming
+  if (!streamingRender)
+    reduceBands(bands->bands);
+}
+
+void SliSource::compositeBands(SurfaceWrapper::Ptr surface,
+                               boost::shared_ptr<BandQueue> bands,
+                               const boost::dynamic_bitset<> &drawable,
+                               int start, int end) {
+  if (bands->bands.empty())
+    return;
+
+  SliSource::Ptr self = shared_from_this<SliSource>();
+  auto work = [self, surface, bands, drawable, start, end]() {
+    for (size_t i = bands->next++; i < bands->bands.size();
+         i = bands->next++) {
+      self->compositeBand(surface, bands->bands[i], drawable, start, end);
+
+      boost::mutex::scoped_lock lock(bands->mtx);
+      if (++bands->nFinished == bands->bands.size())
+        bands->finished.notify_all();
+    }
+  };
+
+  // The bands are disjoint, so helpers can take them in any order. This
+  // thread takes bands as well, so it never waits on helpers that haven't
+  // been started yet.
+  size_t nHelpers =
+      std::min<size_t>(bands->bands.size() - 1,
+                       std::max(1u, boost::thread::hardware_concurrency()) - 1);
+  for (size_t i = 0; i < nHelpers; i++)
+    CpuBound()->schedule(work, PRIO_HIGHER, threadQueue);
+  work();
+
+  boost::mutex::scoped_lock lock(bands->mtx);
+  while (bands->nFinished < bands->bands.size())
+    bands->finished.wait(lock);
+}
+
+void SliSource::compositeBand(SurfaceWrapper::Ptr surface,
+                              Scroom::Utils::Rectangle<int> area,
+                              const boost::dynamic_bitset<> &drawable,
+                              int start, int end) {
+  // Rectangle (in bytes) of the area to composite
+  Scroom::Utils::Rectangle<int> toggledRect = toBytesRectangle(area);
+
+  // The layers are composited into this CMYK buffer rather than into the
+  // surface, which is then written only once, by the conversion
+  static thread_local std::vector<uint8_t> cmyk;
+  const int stride = toggledRect.getWidth();
+  const int rows = toggledRect.getHeight();
+  const int canvasStride = total_width * 4;
+  const int checkpointOffset =
+      pointToOffset(toggledRect.getTopLeft(), canvasStride);
+  size_t firstLayer = 0;
+  if (start < 0) {
+    cmyk.assign(static_cast<size_t>(stride) * rows, 0);
+  } else {
+    cmyk.resize(static_cast<size_t>(stride) * rows);
+    copyRows(cmyk.data(), stride,
+             checkpoints[start].cmyk.data() + checkpointOffset, canvasStride,
+             stride, rows);
+    firstLayer = checkpoints[start].layer;
+  }
+  uint8_t *currentSurfaceByte = cmyk.data();
+
+  // Rows of compressed layers are decoded into this buffer one band at a time
+  static thread_local std::vector<uint8_t> scratch;
+
+  int next = start + 1;
+  for (size_t j : layerIndex->query(toggledRect)) { // For every layer in view
+    if (j < firstLayer || !drawable[j])
       continue;
 
+    // Save the layers below this one into the checkpoints that end here
+    for (; next < end && checkpoints[next].layer <= j; next++) {
+      copyRows(checkpoints[next].cmyk.data() + checkpointOffset, canvasStride,
+               cmyk.data(), stride, stride, rows);
+    }
+
     auto layer = layers[j];
-    auto bitmap = layer->bitmap.get();
     Scroom::Utils::Rectangle<int> layerRect =
         toBytesRectangle(layer->toRectangle(), layer->spp);
 
-    if (!layerRect.intersects(toggledRect))
-      continue;
-
     // Rectangle area (in bytes) of the intersection between the toggled and
     // current rectangles
     Scroom::Utils::Rectangle<int> intersectRect =
         toggledRect.intersection(layerRect);
     // index of the first pixel that needs to be drawn
     int bitmapStart = pointToOffset(layerRect, intersectRect.getTopLeft());
-    // offset of the last pixel from bitmapStart
-    int bitmapOffset = intersectRect.getHeight() * layerRect.getWidth();
-    // offset of the surface pointer from the top-left point of the surface
+    // offset of the first byte to draw from the start of the CMYK buffer
     int surfacePointerOffset =
-        pointToOffset(intersectRect.getTopLeft(), stride);
-    currentSurfaceByte = surfaceBegin + surfacePointerOffset;
-
-    if (hasXoffsets) {
-      int layerBound = std::min(intersectRect.getRight() - layerRect.getLeft(),
-                                layerRect.getRight() - layerRect.getLeft()) %
-                       layerRect.getWidth();
-      drawCmykXoffset(currentSurfaceByte, bitmap, bitmapStart, bitmapOffset,
-                      layerRect, intersectRect, layerBound, stride, layer);
-    } else {
-      drawCmyk(currentSurfaceByte, bitmap, bitmapStart, bitmapOffset, layer);
+        pointToOffset(toggledRect, intersectRect.getTopLeft());
+    int layerBound = std::min(intersectRect.getRight() - layerRect.getLeft(),
+                              layerRect.getRight() - layerRect.getLeft()) %
+                     layerRect.getWidth();
+
+    // Draw the intersection in bands that line up with the tiles of
+    // compressed bitmaps, so each tile is decoded only once. Layers that are
+    // read from disk are read in one go.
+    int firstRow = intersectRect.getTop() - layerRect.getTop();
+    int lastRow = intersectRect.getBottom() - layerRect.getTop();
+    bool fromDisk = streamingRender && !prepareStreamedLayer(layer);
+    for (int row = firstRow; row < lastRow;) {
+      int bandEnd = lastRow;
+      if (!fromDisk) {
+        bandEnd = std::min(lastRow, (row / RleBitmap::TILE_ROWS + 1) *
+                                        RleBitmap::TILE_ROWS);
+      }
+      const uint8_t *bandBitmap =
+          fromDisk ? readLayerRows(layer, row, bandEnd - row, scratch)
+                   : layer->getBitmapRows(row, bandEnd - row, scratch);
+      if (!bandBitmap) {
+        // Already reported, the layer is left out of these rows
+        row = bandEnd;
+        continue;
+      }
+      // index of the first pixel that needs to be drawn, relative to the band
+      int bandStart = bitmapStart - firstRow * layerRect.getWidth();
+      // offset of the last pixel from bandStart
+      int bandOffset = (bandEnd - row) * layerRect.getWidth();
+      currentSurfaceByte =
+          cmyk.data() + surfacePointerOffset + (row - firstRow) * stride;
+
+      if (hasXoffsets) {
+        drawCmykXoffset(currentSurfaceByte, bandBitmap, bandStart, bandOffset,
+                        layerRect, intersectRect, layerBound, stride, layer);
+      } else {
+        drawCmyk(currentSurfaceByte, bandBitmap, bandStart, bandOffset, layer);
+      }
+      row = bandEnd;
     }
   }
 
-  int topLeftOffset = pointToOffset(toggledRect.getTopLeft(), stride);
-  int bottomRightOffset =
-      pointToOffset(toggledRect.getBottomRight(), stride) - stride;
-  if (hasXoffsets) {
-    int toggledBound = toggledRect.getRight() % stride;
-    int toggledWidth = toggledRect.getWidth();
-    convertCmykXoffset(surfaceBegin, targetBegin, topLeftOffset,
-                       bottomRightOffset, toggledWidth, toggledBound, stride);
-  } else {
-    convertCmyk(surfaceBegin, targetBegin, topLeftOffset, bottomRightOffset);
+  // No layers above the remaining checkpoints
+  for (; next < end; next++) {
+    copyRows(checkpoints[next].cmyk.data() + checkpointOffset, canvasStride,
+             cmyk.data(), stride, stride, rows);
   }
 
-  cairo_surface_mark_dirty(surface->surface);
+  const int targetStride = surface->getStride();
+  uint8_t *targetBegin = surface->getBitmap() +
+                         pointToOffset(toggledRect.getTopLeft(), targetStride);
+  convertCmyk(cmyk.data(), stride, reinterpret_cast<uint32_t *>(targetBegin),
+              targetStride, area.getWidth(), area.getHeight());
+}
+
+bool SliSource::prepareStreamedLayer(SliLayer::Ptr layer) {
+  if (layer->hasBitmap())
+    return true;
 
-  if (!rgbCache.count(0))
-    rgbCache[0] = surface;
+  // Mapping costs no memory, so it beats reading the rows
+  return mapBitmaps && !sepSources.count(layer) && layer->mapBitmapFromTiff();
+}
+
+const uint8_t *SliSource::readLayerRows(SliLayer::Ptr layer, int firstRow,
+                                        int rowCount,
+                                        std::vector<uint8_t> &scratch) {
+  if (!sepSources.count(layer))
+    return layer->readBitmapRows(firstRow, rowCount, scratch);
+
+  scratch.resize(static_cast<size_t>(rowCount) * layer->width * layer->spp);
+  sepSources[layer]->fillSliLayerRows(layer, firstRow, rowCount,
+                                      scratch.data());
+  return scratch.data();
+}
+
+void SliSource::checkMemoryFootprint() {
+  size_t total = static_cast<size_t>(total_width) * total_height * 4;
+  for (auto &layer : layers)
+    total += static_cast<size_t>(layer->width) * layer->height * layer->spp;
+
+  streamingRender = total > bitmapMemoryBudget;
+
+  // The checkpoints get a share of the memory the layers leave over
+  size_t spare = streamingRender ? 0 : bitmapMemoryBudget - total;
+  checkpointMemoryBudget = std::min(checkpointMemoryBudget, spare / 4);
 }
 
 void SliSource::clearBottomSurface() {
+  boost::mutex::scoped_lock lock(mtx);
   if (toggled.none())
     return;
 
+  // The layers that are visible now may well be toggled back soon
+  memoizeState(spannedRectangle(toggled, layers));
+
   if (toggled.all() && rgbCache.count(0)) {
     rgbCache[0]->clearSurface();
     // printf("Complete redraw! Area: %d pixels.\n",
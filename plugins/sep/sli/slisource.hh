@@ -2,12 +2,70 @@
 
 #include <scroom/scroominterface.hh>
 #include <scroom/threadpool.hh>
+#include <scroom/viewinterface.hh>
 
 #include <boost/dynamic_bitset.hpp>
+#include <boost/thread.hpp>
 
+#include <atomic>
+#include <deque>
+#include <list>
+
+#include "../colorconfig/CustomColorConfig.hh"
 #include "../sepsource.hh"
+#include "inksums.hh"
+#include "layerindex.hh"
+#include "pyramidcache.hh"
 #include "sli-helpers.hh"
 
+/** The bands of an area that are being composited in parallel */
+struct BandQueue {
+  /** The bands (in pixels) to composite */
+  std::vector<Scroom::Utils::Rectangle<int>> bands;
+
+  /** Index of the next band that hasn't been taken by a thread */
+  std::atomic<size_t> next{0};
+
+  /** Protects nFinished */
+  boost::mutex mtx;
+
+  /** Notified when the last band is finished */
+  boost::condition_variable finished;
+
+  /** Number of bands that have been composited */
+  size_t nFinished = 0;
+};
+
+/**
+ * CMYK composite of all visible layers below a given layer, kept so that
+ * toggling layers above it doesn't require compositing the layers below.
+ */
+struct CompositeCheckpoint {
+  /** Size (in pixels) of the square tiles staleness is tracked for */
+  static const int TILE_SIZE = 256;
+
+  /** Index of the first layer that is not part of the checkpoint */
+  size_t layer;
+
+  /** CMYK bytes of the whole canvas */
+  std::vector<uint8_t> cmyk;
+
+  /** Bitmask of the tiles where the checkpoint is out of date, row by row */
+  boost::dynamic_bitset<> stale;
+};
+
+/** The RGB pixels of an area, as composited for a set of visible layers */
+struct MemoizedState {
+  /** Bitmask of the layers that were visible (little-endian) */
+  boost::dynamic_bitset<> visible;
+
+  /** The area (in pixels) the pixels were copied from */
+  Scroom::Utils::Rectangle<int> area;
+
+  /** ARGB32 pixels of the area, without padding */
+  std::vector<uint8_t> pixels;
+};
+
 class SliSource : public virtual Scroom::Utils::Base {
 public:
   typedef boost::shared_ptr<SliSource> Ptr;
@@ -25,8 +83,84 @@ public:
   /** Whether any of the layers has an xoffset */
   bool hasXoffsets;
 
-  /** Whether the bitmaps of all layers have been imported from the files yet */
-  bool bitmapsImported = false;
+  /**
+   * Whether layer bitmaps are kept run-length encoded in memory whenever
+   * that pays off. Must be set before the bitmaps are imported.
+   */
+  bool compressBitmaps = true;
+
+  /**
+   * Whether uncompressed TIFF layers are memory mapped instead of being read
+   * into memory. Must be set before the bitmaps are imported.
+   */
+  bool mapBitmaps = true;
+
+  /**
+   * Number of bytes the layer bitmaps may occupy before the bitmaps of hidden
+   * layers are evicted. Evicted bitmaps are reloaded when they are needed
+   * again.
+   */
+  size_t bitmapMemoryBudget = static_cast<size_t>(2048) * 1024 * 1024;
+
+  /**
+   * Minimum time (in milliseconds) between two redraws triggered by layers
+   * that finish importing
+   */
+  int streamRedrawInterval = 200;
+
+  /**
+   * Persistent cache of rendered pyramids, so that reopening a job or going
+   * back to a previously viewed combination of layers skips the compositing.
+   * Unset to disable.
+   */
+  PyramidCache::Ptr pyramidCache;
+
+  /**
+   * Whether the layers are read from disk band by band while compositing,
+   * instead of being imported, and the base surface is backed by a temporary
+   * file. Used for jobs that don't fit in memory, see checkMemoryFootprint().
+   */
+  bool streamingRender = false;
+
+  /**
+   * Size (in bytes) of the CMYK buffer a band of rows is composited into.
+   * Should fit in the CPU cache.
+   */
+  int compositeBandBytes = 256 * 1024;
+
+  /** Number of rows composited at a time when streamingRender is set */
+  int streamBandRows = 256;
+
+  /**
+   * Number of layers between two checkpoints. Toggling a layer then only
+   * composites the layers above the checkpoint below it. 0 disables the
+   * checkpoints. Must be set before the first composite.
+   */
+  int checkpointInterval = 8;
+
+  /**
+   * Number of bytes the checkpoints may occupy together. Checkpoints are
+   * spread further apart when needed to stay within it. Lowered by
+   * checkMemoryFootprint() to what the layers leave of bitmapMemoryBudget.
+   */
+  size_t checkpointMemoryBudget = static_cast<size_t>(256) * 1024 * 1024;
+
+  /**
+   * Number of bytes the memoized visibility states may occupy together. The
+   * least recently used states are dropped first.
+   */
+  size_t stateMemoryBudget = static_cast<size_t>(256) * 1024 * 1024;
+
+  /**
+   * When a view is zoomed out to this level or further, toggles are first
+   * composited at the viewed level from the mipmaps of the layers and shown,
+   * before the base level is composited. 0 or above disables the previews.
+   */
+  int previewZoom = -2;
+
+  /** Maximum number of layer bitmaps that are read from disk concurrently */
+  unsigned int importConcurrency =
+      std::max(1u, boost::thread::hardware_concurrency());
 
   /** Bitmask representing the indexes of the currently visible layers
    * (little-endian) */
@@ -60,43 +194,300 @@ private:
 
   /**
    * For each layer that represens a SEP file, this map contains the
-   * corresponding SepSource between reading the metadata of the layer and
-   * reading the bitmap. Afterwards, it's cleared out to save memory.
+   * corresponding SepSource. It is kept around so that evicted bitmaps can
+   * be read again.
    */
   std::map<SliLayer::Ptr, SepSource::Ptr> sepSources;
 
+  /**
+   * For each layer, the canonical path, size and modification time of the
+   * files its pixels come from. Part of the pyramid keys, determined once when
+   * the layer is added.
+   */
+  std::vector<std::string> fileIdentities;
+
+  /** Whether a pyramid is being written to pyramidCache in the background */
+  std::atomic<bool> pyramidStorePending{false};
+
+  /**
+   * Whether a fillCache() task scheduled by getSurface() hasn't finished yet.
+   * Views already show the bands composited so far, so redrawing them
+   * doesn't schedule another one.
+   */
+  std::atomic<bool> fillPending{false};
+
+  /**
+   * For each layer, the number of the compositeArea() call that last drew it.
+   * Used to evict the least recently used bitmaps first.
+   */
+  std::vector<unsigned int> lastUsed;
+
+  /** The number of compositeArea() calls so far */
+  unsigned int nCompositions = 0;
+
+  /** Bitmask representing the indexes of the layers whose bitmap has been
+   * imported and can be drawn (little-endian) */
+  boost::dynamic_bitset<> imported{0};
+
+  /** Bitmask representing the indexes of the layers that are queued for
+   * import or being imported (little-endian) */
+  boost::dynamic_bitset<> importing{0};
+
+  /** Indexes of the layers waiting for an import task, in order */
+  std::deque<size_t> importQueue;
+
+  /** Number of import tasks currently scheduled or running */
+  size_t nImportWorkers = 0;
+
+  /** Protects imported, importing, importQueue and nImportWorkers */
+  boost::mutex importMtx;
+
+  /** Notified whenever the import of a layer finishes */
+  boost::condition_variable importFinished;
+
+  /** Bitmask representing the indexes of the layers that have been imported
+   * but not yet composited by compositeImported() (little-endian) */
+  boost::dynamic_bitset<> streamed{0};
+
+  /** Whether a compositeImported() task is pending */
+  bool streamScheduled = false;
+
+  /** When compositeImported() last collected the streamed layers */
+  boost::posix_time::ptime lastStreamRedraw{
+      boost::posix_time::min_date_time};
+
+  /** The area (in pixels) currently shown by each view. Layers inside these
+   * areas are imported first. Protected by importMtx. */
+  std::map<ViewInterface::WeakPtr, Scroom::Utils::Rectangle<int>> viewAreas;
+
+  /** The zoom level of each view. Protected by importMtx. */
+  std::map<ViewInterface::WeakPtr, int> viewZooms;
+
+  /** Ink sums of the bottom surface, for the pipette */
+  InkSums::Ptr inkSums;
+
+  /**
+   * Index over the rectangles (in bytes, as they are composited) of the
+   * layers. Rebuilt by compositeArea() when layers are added.
+   */
+  LayerIndex::Ptr layerIndex;
+
+  /** Composites of the layers below evenly spaced layers, in layer order */
+  std::vector<CompositeCheckpoint> checkpoints;
+
+  /**
+   * Whether createCheckpoints() has run, even if no checkpoints fit in the
+   * budget
+   */
+  bool checkpointsCreated = false;
+
+  /** Recently composited states, most recently used first */
+  std::list<MemoizedState> memoizedStates;
+
 private:
   /** Constructor */
   SliSource(boost::function<void()> &triggerRedrawFunc);
 
   /**
-   * Computes the complete RGB bitmap from the CMYK bitmap and caches the result
+   * Computes the RGB bitmap of the area spanned by the toggled layers and
+   * caches the result for all zoom levels
    */
   virtual void computeRgb();
 
   /**
-   * Reduces the RGB bitmap and caches the result.
-   * The bitmap is divided into roughly 24+ segments whose height is a multiple
-   * of 2. This creates a one-to-one mapping between each pixel of zoom level
-   * @param zoom and a 2x2 square of pixels of zoom level @param zoom+1.
-   * @param multithreading indicates whether more than one thread will
-   * "possibly" be used for the reduction. This choice also depends on the
-   * number of toggled segments: if only a handful are toggled, the additional
-   * overhead of threads is not worth it.
+   * Composites all visible, imported layers over @param area (in pixels) of
+   * the bottom surface, which must have been cleared, converts the result
+   * to RGB and reduces it into the other zoom levels. Visible layers that
+   * haven't been imported yet are queued for import.
+   * @param firstChanged is the lowest layer that changed since the area was
+   * last composited. Compositing starts from the checkpoint below it.
+   */
+  virtual void compositeArea(Scroom::Utils::Rectangle<int> area,
+                             size_t firstChanged = 0);
+
+  /**
+   * Composites the layers in @param drawable over @param area (in pixels)
+   * into a thread-local CMYK buffer, then converts the result to RGB and
+   * writes it to @param surface. Part of compositeArea().
+   * @param start is the checkpoint to start from, or -1 to start from blank.
+   * The buffer is copied into the checkpoints after it, up to (excluding)
+   * @param end, when their layer is reached.
+   */
+  virtual void compositeBand(SurfaceWrapper::Ptr surface,
+                             Scroom::Utils::Rectangle<int> area,
+                             const boost::dynamic_bitset<> &drawable,
+                             int start, int end);
+
+  /**
+   * Composites @param bands in parallel on the CPU bound thread pool, using
+   * compositeBand(). Returns once all bands are done.
    */
-  virtual void reduceRgb(int zoom, bool multithreading);
+  virtual void compositeBands(SurfaceWrapper::Ptr surface,
+                              boost::shared_ptr<BandQueue> bands,
+                              const boost::dynamic_bitset<> &drawable,
+                              int start, int end);
 
   /**
-   * Reduces all the segments set in @param toggledSegments for zoom level
-   * @param zoom.
-   * @param baseSegHeight is the height of a segment in the base surface (zoom
-   * level 0).
-   * @param targetSurface is the surface on top of which the reduced segments
-   * will be copied.
+   * Orders @param bands (in pixels) by their distance to the areas shown by
+   * the views, nearest first, so that what is being looked at is composited
+   * first.
+   * @return the number of bands that intersect the area of a view
    */
-  virtual void reduceSegments(SurfaceWrapper::Ptr targetSurface,
-                              boost::dynamic_bitset<> toggledSegments,
-                              int baseSegHeight, int zoom);
+  virtual size_t
+  sortBandsByViews(std::vector<Scroom::Utils::Rectangle<int>> &bands);
+
+  /**
+   * Composites the toggled area shown by every view that is zoomed out to
+   * previewZoom or further, directly at its zoom level, and triggers a
+   * redraw. The result is approximate, until compositeArea() replaces it.
+   */
+  virtual void compositePreviews();
+
+  /**
+   * Composites @param area (in pixels of zoom level 0) of zoom level
+   * @param zoom from the mipmaps of the visible, imported layers, and reduces
+   * it into the levels below.
+   */
+  virtual void compositePreview(int zoom, Scroom::Utils::Rectangle<int> area);
+
+  /** Updates inkSums over @param area (in pixels) of the bottom surface */
+  virtual void updateInkSums(Scroom::Utils::Rectangle<int> area);
+
+  /** (Re)builds layerIndex from the current layers */
+  virtual void updateLayerIndex();
+
+  /**
+   * Allocates the checkpoints, every checkpointInterval layers, as far as
+   * checkpointMemoryBudget allows. Not used when streaming.
+   */
+  virtual void createCheckpoints();
+
+  /** Bitmask of the checkpoint tiles intersecting @param area (in pixels) */
+  virtual boost::dynamic_bitset<>
+  checkpointTiles(Scroom::Utils::Rectangle<int> area);
+
+  /**
+   * Finds the highest checkpoint that is up to date over @param area and
+   * doesn't include layer @param firstChanged.
+   * @return its index, or -1 if compositing has to start from blank
+   */
+  virtual int findCheckpoint(Scroom::Utils::Rectangle<int> area,
+                             size_t firstChanged);
+
+  /**
+   * Records that the checkpoints that include layer @param firstChanged are
+   * out of date over @param area (in pixels).
+   */
+  virtual void markCheckpointsStale(Scroom::Utils::Rectangle<int> area,
+                                    size_t firstChanged);
+
+  /**
+   * Whether every visible layer has been composited into the cached
+   * surfaces. importMtx must be held.
+   */
+  virtual bool isComplete();
+
+  /**
+   * Remembers the pixels of @param area (in pixels) of the bottom surface
+   * for the currently visible layers, so that toggling back to them doesn't
+   * need compositing. Called with mtx held, off the UI thread.
+   */
+  virtual void memoizeState(Scroom::Utils::Rectangle<int> area);
+
+  /**
+   * Copies the pixels of @param area (in pixels) for the currently visible
+   * layers into the bottom surface, if they were memoized, and reduces them
+   * into the other zoom levels.
+   * @return true if the state was memoized
+   */
+  virtual bool restoreState(Scroom::Utils::Rectangle<int> area);
+
+  /**
+   * Switches the channels of the layers to the colors of the same name in
+   * @param colors. Recomposites the visible layers whose colors changed and
+   * forgets the memoized states that include them. Bitmaps and mipmaps only
+   * hold samples, so they are kept.
+   */
+  virtual void recolor(ColorTable::ConstPtr colors);
+
+  /**
+   * Makes the bitmap of @param layer accessible without reading it, by
+   * mapping it if possible.
+   * @return false if the rows have to be read with readLayerRows() instead
+   */
+  virtual bool prepareStreamedLayer(SliLayer::Ptr layer);
+
+  /**
+   * Reads rows [@param firstRow, @param firstRow + @param rowCount) of
+   * @param layer from disk into @param scratch.
+   * @return a pointer to the rows inside @param scratch, or nullptr if they
+   * could not be read
+   */
+  virtual const uint8_t *readLayerRows(SliLayer::Ptr layer, int firstRow,
+                                       int rowCount,
+                                       std::vector<uint8_t> &scratch);
+
+  /**
+   * Composites the layers that finished importing since the last call and
+   * updates the reduced surfaces. importNext() schedules it at most once
+   * every streamRedrawInterval milliseconds, except for the last import of
+   * the queue.
+   */
+  virtual void compositeImported();
+
+  /** Describes the files the pixels of @param layer come from */
+  virtual std::string identifyFiles(SliLayer::Ptr layer);
+
+  /**
+   * Identifies the pyramid of the layers in @param mask: the layer files,
+   * their placement and their colours.
+   */
+  virtual std::string pyramidKey(const boost::dynamic_bitset<> &mask);
+
+  /**
+   * Replaces the cached surfaces by the pyramid from pyramidCache, if one has
+   * been stored for the visible layers.
+   * @return true if the pyramid was found
+   */
+  virtual bool loadPyramid();
+
+  /**
+   * Writes a copy of the cached surfaces to pyramidCache in the background,
+   * provided every visible layer has been composited into them and no other
+   * pyramid is being written.
+   */
+  virtual void storePyramid();
+
+  /**
+   * Updates @param area (in pixels of zoom level 0) of all reduced zoom
+   * levels (-1 to -30) in a single walk over the base surface. Every row of a
+   * reduced level is computed right after the two rows it is made of, while
+   * those are still in the CPU cache, instead of streaming each level through
+   * memory again. Missing levels are created.
+   * @param multithreading allows splitting large areas over two threads.
+   */
+  virtual void reducePyramid(Scroom::Utils::Rectangle<int> area,
+                             bool multithreading);
+
+  /**
+   * Reduces the rows of @param bands (in pixels of zoom level 0) into the
+   * other zoom levels. Bands that touch are reduced together.
+   */
+  virtual void reduceBands(std::vector<Scroom::Utils::Rectangle<int>> bands);
+
+  /**
+   * Reduces zoom level @param sourceZoom into the levels below it, down to
+   * and including @param lastZoom. Only the pixels covering @param area (in
+   * pixels of @param sourceZoom) are updated. Part of reducePyramid().
+   */
+  virtual void reduceLevels(int sourceZoom, int lastZoom,
+                            Scroom::Utils::Rectangle<int> area);
+
+  /**
+   * Computes columns [@param firstColumn, @param lastColumn] of row @param y
+   * of zoom level @param zoom by averaging 2x2 squares of level @param zoom+1.
+   */
+  virtual void reduceRow(int zoom, int y, int firstColumn, int lastColumn);
 
   /**
    * Checks if the bitmap required for displaying the zoom level is present. If
@@ -117,7 +508,7 @@ private:
    * @param bitmapOffset is the offset from bitmapStart of the bitmap area to
    * draw.
    */
-  virtual void drawCmyk(uint8_t *surfacePointer, uint8_t *bitmap,
+  virtual void drawCmyk(uint8_t *surfacePointer, const uint8_t *bitmap,
                         int bitmapStart, int bitmapOffset, SliLayer::Ptr layer);
 
   /**
@@ -133,51 +524,72 @@ private:
    * @param intersectRect represents the area of the current layer that
    * intersects the canvas.
    * @param layerBound is the right bound of area to draw.
-   * @param stride is the stride of the entire SLI image.
+   * @param stride is the stride of the CMYK buffer drawn onto.
    */
-  virtual void drawCmykXoffset(uint8_t *surfacePointer, uint8_t *bitmap,
+  virtual void drawCmykXoffset(uint8_t *surfacePointer, const uint8_t *bitmap,
                                int bitmapStart, int bitmapOffset,
                                Scroom::Utils::Rectangle<int> layerRect,
                                Scroom::Utils::Rectangle<int> intersectRect,
                                int layerBound, int stride, SliLayer::Ptr layer);
 
   /**
-   * Converts the a CMYK surface to an RGB surface.
-   * @param surfacePointer is a pointer to the first byte of the surface.
-   * @param targetPointer is a pointer to the first pixel of the surface.
-   * @param topLeftOffset is the offset from coordinate (0,0) of the first byte
-   * of the surface.
-   * @param bottomRightOffset is the offset from coordinate (0,0) of the last
-   * byte of the surface.
+   * Converts a block of CMYK pixels to RGB.
+   * @param cmyk is a pointer to the first CMYK pixel.
+   * @param cmykStride is the number of bytes between two rows of @param cmyk.
+   * @param targetPointer is a pointer to the first pixel to write.
+   * @param targetStride is the number of bytes between two rows of
+   * @param targetPointer.
+   * @param width and @param height are the size of the block in pixels.
+   */
+  virtual void convertCmyk(const uint8_t *cmyk, int cmykStride,
+                           uint32_t *targetPointer, int targetStride,
+                           int width, int height);
+
+  /**
+   * Import the bitmap data from the file into the SliLayer. Computationally
+   * intensive, therefore done outside of UI thread, the first time the layer
+   * needs to be drawn.
+   */
+  virtual void importBitmap(SliLayer::Ptr layer);
+
+  /**
+   * Take the first layer off importQueue, import it and mark it as imported.
+   * @param lock must hold importMtx; it is released during the import.
    */
-  virtual void convertCmyk(uint8_t *surfacePointer, uint32_t *targetPointer,
-                           int topLeftOffset, int bottomRightOffset);
+  virtual void importNext(boost::mutex::scoped_lock &lock);
 
   /**
-   * Converts the a CMYK surface to an RGB surface. It is similar to convertCmyk
-   * but it also supports SLI files with xoffsets. However, it is noticeably
-   * slower.
-   * @param surfacePointer is a pointer to the first byte of the surface.
-   * @param targetPointer is a pointer to the first pixel of the surface.
-   * @param topLeftOffset is the offset from coordinate (0,0) of the first byte
-   * of the surface.
-   * @param bottomRightOffset is the offset from coordinate (0,0) of the last
-   * byte of the surface.
-   * @param toggledWidth represents the width of the area of the surface that
-   * needs to be converted.
-   * @param toggledBound represents the right bound of the area to convert.
-   * @param stride is the stride of the entire SLI image.
+   * Task on the thread pool that imports queued layers, one at a time, until
+   * the queue is empty.
    */
-  virtual void convertCmykXoffset(uint8_t *surfacePointer,
-                                  uint32_t *targetPointer, int topLeftOffset,
-                                  int bottomRightOffset, int toggledWidth,
-                                  int toggledBound, int stride);
+  virtual void importWorker();
+
+  /** Move the queued layers that intersect a view area to the front of
+   * importQueue. importMtx must be held. */
+  virtual void prioritizeImports();
 
   /**
-   * For each SliLayer in layers, import the bitmap data from the file into the
-   * SliLayer. Computationally intensive, therefore done outside of UI thread.
+   * Start import tasks for queued layers, as long as fewer than
+   * importConcurrency are scheduled. importMtx must be held.
    */
-  virtual void importBitmaps();
+  virtual void scheduleImports();
+
+  /** Queue the import of all layers set in @param layerMask that are neither
+   * imported nor queued yet */
+  virtual void queueImports(const boost::dynamic_bitset<> &layerMask);
+
+  /**
+   * Block until all layers set in @param layerMask have been imported. The
+   * calling thread imports queued layers itself while it waits, so progress
+   * does not depend on other threads of the pool being available.
+   */
+  virtual void waitForImports(const boost::dynamic_bitset<> &layerMask);
+
+  /**
+   * If the layer bitmaps take up more than bitmapMemoryBudget bytes, unload
+   * the bitmaps of hidden layers, least recently drawn first.
+   */
+  virtual void evictBitmaps();
 
 public:
   /** Destructor */
@@ -201,6 +613,13 @@ public:
    */
   virtual void checkXoffsets();
 
+  /**
+   * Enables streamingRender if the layers and the base surface together
+   * would exceed bitmapMemoryBudget. Otherwise, limits checkpointMemoryBudget
+   * to a quarter of the memory they leave.
+   */
+  virtual void checkMemoryFootprint();
+
   /**
    * Get the SurfaceWrapper for the surface that is needed to display the zoom
    * level. If it is not cached yet, enqueue its computation
@@ -210,6 +629,13 @@ public:
    */
   virtual SurfaceWrapper::Ptr getSurface(int zoom);
 
+  /**
+   * Returns the sums of the C, M, Y and K values of the pixels in
+   * @param area (in pixels) of the bottom surface, derived from their RGB
+   * values. Fast for areas of any size.
+   */
+  virtual InkSums::Sum getInkSums(Scroom::Utils::Rectangle<int> area);
+
   /**
    * Create a new SliLayer and add it to the list of layers.
    * @param imagePath is the absolute path to the tif/sep file.
@@ -221,13 +647,25 @@ public:
                         int xOffset, int yOffset);
 
   /**
-   * Query the execution of importBitmaps() in a separate thread.
+   * Start importing the bitmaps of the layers that will be visible after the
+   * next redraw, each layer as a separate task on the thread pool.
    */
   virtual void queryImportBitmaps();
 
+  /** Record the area (in pixels) shown by @param view at zoom level
+   * @param zoom */
+  virtual void setViewArea(ViewInterface::WeakPtr view,
+                           Scroom::Utils::Rectangle<int> area, int zoom);
+
+  /** Forget the area shown by @param view */
+  virtual void removeViewArea(ViewInterface::WeakPtr view);
+
+  /** Recolors the layers with @param colors on the thread pool */
+  virtual void setColors(ColorTable::ConstPtr colors);
+
   /**
    * Clear (ie write 0s) the area of the bottom surface intersecting with the
-   * toggled layers and trigger a redraw.
+   * toggled layers and trigger a redraw. Both happen on the thread pool.
    */
   virtual void wipeCacheAndRedraw();
 
@@ -52,4 +52,60 @@ BOOST_AUTO_TEST_CASE(colorConfig_get_name) {
   BOOST_CHECK(colorConfig.getColorByNameOrAlias("b") != nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(colorConfig_get_name_or_alias_any_case) {
+  ColorConfig colorConfig;
+
+  CustomColor::Ptr orange =
+      boost::make_shared<CustomColor>("ORANGE", 0, 0.5, 1, 0);
+  orange->aliases = {"O", "PANTONE 021"};
+  CustomColor::Ptr other = boost::make_shared<CustomColor>("OTHER", 0, 0, 0, 1);
+  other->aliases = {"O"};
+  colorConfig.addColor(orange);
+  colorConfig.addColor(other);
+
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("orange") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("Pantone 021") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("other") == other);
+  // The first color defined with an alias wins
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("o") == orange);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("pantone") == nullptr);
+
+  // Reloading replaces the index
+  colorConfig.loadFile(TestFiles::getPathToFile("colours.json"));
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("orange") == nullptr);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("B") != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(colorConfig_snapshots) {
+  ColorConfig colorConfig;
+  std::vector<ColorTable::ConstPtr> notified;
+  unsigned int id = colorConfig.addListener(
+      [&notified](ColorTable::ConstPtr colors) { notified.push_back(colors); });
+
+  colorConfig.loadFile(TestFiles::getPathToFile("colours.json"));
+  ColorTable::ConstPtr first = colorConfig.getColors();
+  BOOST_REQUIRE(notified.size() == 1);
+  BOOST_CHECK(notified.back() == first);
+  BOOST_CHECK(first->version == 1);
+
+  // Loading the same colors again doesn't publish a new table
+  colorConfig.loadFile(TestFiles::getPathToFile("colours.json"));
+  BOOST_CHECK(colorConfig.getColors() == first);
+  BOOST_CHECK(notified.size() == 1);
+
+  // Other colors do, and the earlier table stays as it was
+  colorConfig.loadFile(TestFiles::getPathToFile("nonexistent.json"));
+  BOOST_REQUIRE(notified.size() == 2);
+  BOOST_CHECK(notified.back() == colorConfig.getColors());
+  BOOST_CHECK(colorConfig.getColors() != first);
+  BOOST_CHECK(colorConfig.getColors()->version == 2);
+  BOOST_CHECK(colorConfig.getColorByNameOrAlias("b") == nullptr);
+  BOOST_CHECK(first->find("b") != nullptr);
+  BOOST_CHECK(first->colors.size() == 5);
+
+  colorConfig.removeListener(id);
+  colorConfig.loadFile(TestFiles::getPathToFile("colours.json"));
+  BOOST_CHECK(notified.size() == 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
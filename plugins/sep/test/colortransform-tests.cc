@@ -0,0 +1,74 @@
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+#define private public
+
+#include "../colorconfig/ColorTransform.hh"
+#include "../colorconfig/CustomColorHelpers.hh"
+#include "testglobals.hh"
+
+namespace {
+std::vector<CustomColor::Ptr> testChannels() {
+  return {boost::make_shared<CustomColor>("c", 1, 0, 0, 0),
+          boost::make_shared<CustomColor>("orange", 0, 0.35f, 0.9f, 0.05f),
+          boost::make_shared<CustomColor>("grey", 0.1f, 0.1f, 0.1f, 0.5f)};
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(ColorTransform_Tests)
+
+BOOST_AUTO_TEST_CASE(colortransform_matches_multipliers) {
+  auto channels = testChannels();
+  ColorTransform::Ptr transform = ColorTransform::get(channels);
+  BOOST_REQUIRE(transform->getSpp() == 3);
+
+  const uint8_t samples[][3] = {
+      {0, 0, 0}, {255, 255, 255}, {17, 200, 3}, {128, 64, 250}};
+  uint8_t surface[4][4] = {{0, 0, 0, 0}, {10, 20, 30, 40}, {0, 0, 0, 0},
+                           {100, 0, 200, 255}};
+  for (int i = 0; i < 4; i++) {
+    // The surface holds what earlier layers drew
+    int16_t C = surface[i][0];
+    int16_t M = surface[i][1];
+    int16_t Y = surface[i][2];
+    int16_t K = surface[i][3];
+    for (size_t j = 0; j < channels.size(); j++)
+      CustomColorHelpers::calculateCMYK(channels[j], C, M, Y, K,
+                                        samples[i][j]);
+
+    transform->apply(samples[i], surface[i], 1);
+    BOOST_CHECK_EQUAL(surface[i][0], CustomColorHelpers::toUint8(C));
+    BOOST_CHECK_EQUAL(surface[i][1], CustomColorHelpers::toUint8(M));
+    BOOST_CHECK_EQUAL(surface[i][2], CustomColorHelpers::toUint8(Y));
+    BOOST_CHECK_EQUAL(surface[i][3], CustomColorHelpers::toUint8(K));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(colortransform_to_argb) {
+  ColorTransform::Ptr transform = ColorTransform::get(
+      {boost::make_shared<CustomColor>("c", 1, 0, 0, 0),
+       boost::make_shared<CustomColor>("k", 0, 0, 0, 1)});
+  const uint8_t samples[] = {0, 0, 255, 0, 0, 255};
+  uint32_t target[3];
+  transform->toArgb(samples, target, 3);
+  BOOST_CHECK_EQUAL(target[0], 0xFFFFFFFF);
+  BOOST_CHECK_EQUAL(target[1], 0xFF00FFFF);
+  BOOST_CHECK_EQUAL(target[2], 0xFF000000);
+}
+
+BOOST_AUTO_TEST_CASE(colortransform_shared_per_channel_set) {
+  auto channels = testChannels();
+  ColorTransform::Ptr first = ColorTransform::get(channels);
+  BOOST_CHECK(ColorTransform::get(channels) == first);
+  BOOST_CHECK(first->matches(channels));
+
+  // Equal multipliers, but different colors
+  auto other = testChannels();
+  BOOST_CHECK(ColorTransform::get(other) != first);
+  BOOST_CHECK(!first->matches(other));
+
+  // Every table starts on a cache line
+  for (auto &table : first->tables)
+    BOOST_CHECK(reinterpret_cast<uintptr_t>(&table) % 64 == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
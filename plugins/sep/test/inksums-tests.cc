@@ -0,0 +1,76 @@
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+
+// Make all private members accessible for testing
+#define private public
+
+#include "../sli/inksums.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+InkSums::Sum sumPixels(const std::vector<uint8_t> &argb, int stride,
+                       Scroom::Utils::Rectangle<int> area) {
+  InkSums::Sum sum = {};
+  for (int y = area.getTop(); y < area.getBottom(); y++) {
+    for (int x = area.getLeft(); x < area.getRight(); x++)
+      InkSums::addPixel(argb.data() + y * stride + x * 4, sum);
+  }
+  return sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests
+
+BOOST_AUTO_TEST_SUITE(Sli_Tests)
+
+BOOST_AUTO_TEST_CASE(inksums_add_pixel) {
+  // B, G, R, A
+  const uint8_t red[] = {0, 0, 255, 255};
+  const uint8_t grey[] = {155, 155, 155, 255};
+  const uint8_t transparent[] = {0, 0, 0, 0};
+  InkSums::Sum sum = {};
+  InkSums::addPixel(red, sum);
+  BOOST_REQUIRE(sum == (InkSums::Sum{0, 255, 255, 0}));
+  InkSums::addPixel(grey, sum);
+  BOOST_REQUIRE(sum == (InkSums::Sum{0, 255, 255, 100}));
+  InkSums::addPixel(transparent, sum);
+  BOOST_REQUIRE(sum == (InkSums::Sum{0, 255, 255, 100}));
+}
+
+BOOST_AUTO_TEST_CASE(inksums_match_pixels) {
+  // Not a multiple of the tile size, with padding at the end of the rows
+  const int width = 5 * InkSums::TILE_SIZE + 13;
+  const int height = 3 * InkSums::TILE_SIZE + 7;
+  const int stride = width * 4 + 16;
+  std::vector<uint8_t> argb(stride * height);
+  srand(42);
+  for (auto &value : argb)
+    value = rand() % 256;
+
+  auto sums = InkSums::create(width, height);
+  sums->update(argb.data(), stride, {0, 0, width, height});
+  for (int i = 0; i < 200; i++) {
+    // Change part of the surface now and then
+    if (i % 10 == 0) {
+      Scroom::Utils::Rectangle<int> changed{rand() % width, rand() % height,
+                                            1 + rand() % 100, 1 + rand() % 100};
+      changed = changed.intersection({0, 0, width, height});
+      for (int y = changed.getTop(); y < changed.getBottom(); y++) {
+        for (int x = changed.getLeft() * 4; x < changed.getRight() * 4; x++)
+          argb[y * stride + x] = rand() % 256;
+      }
+      sums->update(argb.data(), stride, changed);
+    }
+
+    Scroom::Utils::Rectangle<int> area{rand() % width, rand() % height,
+                                       rand() % width, rand() % height};
+    if (i % 20 == 0)
+      area = {0, 0, width, height};
+    auto expected =
+        sumPixels(argb, stride, area.intersection({0, 0, width, height}));
+    BOOST_REQUIRE(sums->getSum(argb.data(), stride, area) == expected);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,45 @@
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+
+// Make all private members accessible for testing
+#define private public
+
+#include "../sli/layerindex.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests
+
+BOOST_AUTO_TEST_SUITE(Sli_Tests)
+
+BOOST_AUTO_TEST_CASE(layerindex_matches_linear_scan) {
+  // Lots of small layers, like labels
+  std::vector<Scroom::Utils::Rectangle<int>> rects;
+  srand(42);
+  for (int i = 0; i < 2000; i++)
+    rects.push_back({rand() % 5000, rand() % 5000, rand() % 200, rand() % 50});
+  auto index = LayerIndex::create(rects);
+  BOOST_REQUIRE(index->size() == rects.size());
+
+  for (int i = 0; i < 100; i++) {
+    Scroom::Utils::Rectangle<int> area{rand() % 5000, rand() % 5000,
+                                       1 + rand() % 1000, 1 + rand() % 100};
+    std::vector<size_t> expected;
+    for (size_t j = 0; j < rects.size(); j++) {
+      if (rects[j].getWidth() > 0 && rects[j].getHeight() > 0 &&
+          rects[j].intersects(area))
+        expected.push_back(j);
+    }
+    BOOST_REQUIRE(index->query(area) == expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(layerindex_touching_rectangles) {
+  auto index = LayerIndex::create({{0, 0, 10, 10}, {10, 0, 10, 10}});
+  BOOST_REQUIRE(index->query({10, 0, 5, 5}) == std::vector<size_t>{1});
+  BOOST_REQUIRE(index->query({5, 5, 10, 10}) ==
+                (std::vector<size_t>{0, 1}));
+  BOOST_REQUIRE(index->query({0, 10, 20, 5}).empty());
+  BOOST_REQUIRE(index->query({0, 0, 0, 0}).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,58 @@
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+
+// Make all private members accessible for testing
+#define private public
+
+#include "../sli/rlebitmap.hh"
+#include "../sli/slilayer.hh"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests
+
+BOOST_AUTO_TEST_SUITE(Sli_Tests)
+
+BOOST_AUTO_TEST_CASE(rlebitmap_roundtrip_cmyk) {
+  const int width = 37;
+  const int height = 2 * RleBitmap::TILE_ROWS + 3;
+  std::vector<uint8_t> bitmap(width * height * 4);
+  // Flat areas interrupted by a few distinct pixels
+  for (size_t i = 0; i < bitmap.size(); i++)
+    bitmap[i] = (i % 97 == 0) ? static_cast<uint8_t>(i) : (i / 4 / 11) % 2;
+
+  auto rle = RleBitmap::create(bitmap.data(), width, height, 4);
+  std::vector<uint8_t> scratch;
+  for (int row = 0; row < height; row++) {
+    const uint8_t *rows = rle->decodeRows(row, height - row, scratch);
+    BOOST_REQUIRE(memcmp(rows, bitmap.data() + row * width * 4,
+                         (height - row) * width * 4) == 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(rlebitmap_flat_compresses) {
+  const int width = 1000;
+  const int height = 100;
+  std::vector<uint8_t> bitmap(width * height * 4, 0);
+  auto rle = RleBitmap::create(bitmap.data(), width, height, 4);
+  BOOST_REQUIRE(rle->getSize() * 50 < bitmap.size());
+}
+
+BOOST_AUTO_TEST_CASE(slilayer_compress_bitmap) {
+  SliLayer::Ptr layer = SliLayer::create("", "flat.tif", 0, 0);
+  layer->width = 64;
+  layer->height = 64;
+  layer->spp = 4;
+  layer->bitmap.reset(new uint8_t[64 * 64 * 4]());
+  layer->bitmap[5] = 42;
+
+  BOOST_REQUIRE(layer->compressBitmap());
+  BOOST_REQUIRE(layer->bitmap == nullptr);
+  BOOST_REQUIRE(layer->hasBitmap());
+
+  std::vector<uint8_t> scratch;
+  const uint8_t *rows = layer->getBitmapRows(0, 1, scratch);
+  BOOST_REQUIRE(rows[5] == 42);
+  BOOST_REQUIRE(rows[6] == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
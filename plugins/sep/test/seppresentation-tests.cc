@@ -1,6 +1,9 @@
 #include <boost/dll.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include <cmath>
+#include <gdk/gdk.h>
 
 // Make all private members accessible for testing
 #define private public
@@ -97,4 +100,58 @@ BOOST_AUTO_TEST_CASE(seppresentation_pipette) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(seppresentation_pipette_tile_sums) {
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  BOOST_REQUIRE(!presentation->sep_source->record_tile_sums);
+  presentation->sep_source->record_tile_sums = true;
+  BOOST_REQUIRE(presentation->load(TestFiles::getPathToFile("sep_cmyk.sep")));
+  auto rect = presentation->getRect().toIntRectangle();
+
+  // The first measurement loads the tiles, which records their sums
+  auto loaded = presentation->getPixelAverages(rect);
+  std::vector<size_t> sums;
+  BOOST_REQUIRE(presentation->sep_source->getTileSums(0, 0, sums));
+
+  // The second one adds those up instead, with the same outcome
+  auto recorded = presentation->getPixelAverages(rect);
+  BOOST_REQUIRE(loaded.size() == recorded.size());
+  for (size_t i = 0; i < loaded.size(); i++) {
+    BOOST_CHECK(loaded[i].first == recorded[i].first);
+    BOOST_CHECK_CLOSE(loaded[i].second, recorded[i].second, 1e-9);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(seppresentation_recolor) {
+  SepPresentation::Ptr presentation = SepPresentation::create();
+  BOOST_REQUIRE(presentation->load(TestFiles::getPathToFile("sep_cmyk.sep")));
+  std::string channel = presentation->sep_source->getChannels().front();
+
+  ColorConfig &colorConfig = ColorConfig::getInstance();
+  ColorTable::ConstPtr original = colorConfig.getColors();
+  ColorTable::Ptr changed = boost::make_shared<ColorTable>();
+  CustomColor::Ptr color =
+      boost::make_shared<CustomColor>(channel, 0.5f, 0.5f, 0, 0);
+  changed->addColor(color);
+  for (auto &other : original->colors)
+    changed->addColor(other);
+
+  // The file monitor publishes from the main loop, holding the GDK lock
+  gdk_threads_enter();
+  colorConfig.publish(changed);
+  gdk_threads_leave();
+
+  for (int i = 0; i < 500; i++) {
+    if (presentation->layer_operations->getColors().front() == color)
+      break;
+    boost::this_thread::sleep(boost::posix_time::millisec(10));
+  }
+  BOOST_CHECK(presentation->layer_operations->getColors().front() == color);
+
+  // A table older than the one applied last is skipped
+  presentation->recolor(original);
+  BOOST_CHECK(presentation->layer_operations->getColors().front() == color);
+
+  colorConfig.publish(boost::make_shared<ColorTable>(*original));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
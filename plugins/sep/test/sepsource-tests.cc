@@ -1,4 +1,5 @@
 #include <boost/dll.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/test/unit_test.hpp>
 
 // Make all private members accessible for testing
@@ -337,4 +338,37 @@ BOOST_AUTO_TEST_CASE(sepsource_fill_no_tiles) {
   BOOST_CHECK(true);
 }
 
+BOOST_AUTO_TEST_CASE(sepsource_tile_sums_partial_fill) {
+  // Preparation
+  std::vector<size_t> sums;
+  auto source = SepSource::create();
+  SepFile file = SepSource::parseSep(TestFiles::getPathToFile("sep_cmyk.sep"));
+  source->setData(file);
+  source->openFiles();
+  source->record_tile_sums = true;
+
+  const int tileWidth = 4096;
+  const size_t bpp = 4;
+  const size_t stride = tileWidth * bpp;
+  Scroom::MemoryBlobs::RawPageData::Ptr data(
+      new uint8_t[stride * file.height], std::default_delete<uint8_t[]>());
+  std::vector<Tile::Ptr> tiles = {
+      boost::make_shared<Tile>(tileWidth, tileWidth, 8 * bpp, data)};
+
+  // Tested call: a tile that isn't filled completely has no sums
+  source->fillTiles(0, static_cast<int>(file.height) / 2, tileWidth, 0, tiles);
+  BOOST_CHECK(!source->getTileSums(0, 0, sums));
+  BOOST_CHECK(sums.empty());
+
+  // Tested call: the sums of a complete tile match its samples
+  source->fillTiles(0, static_cast<int>(file.height), tileWidth, 0, tiles);
+  BOOST_REQUIRE(source->getTileSums(0, 0, sums));
+  std::vector<size_t> expected(bpp, 0);
+  for (size_t y = 0; y < file.height; y++) {
+    for (size_t x = 0; x < file.width * bpp; x++)
+      expected[x % bpp] += data.get()[y * stride + x];
+  }
+  BOOST_CHECK(sums == expected);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
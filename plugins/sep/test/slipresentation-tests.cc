@@ -23,6 +23,8 @@ SliPresentation::Ptr createPresentation() {
   // Assign the callbacks to dummy functions to avoid exceptions
   presentation->source->enableInteractions = boost::bind(dummyFunc);
   presentation->source->disableInteractions = boost::bind(dummyFunc);
+  // Keep the tests independent of pyramids cached by earlier runs
+  presentation->source->pyramidCache = nullptr;
 
   return presentation;
 }
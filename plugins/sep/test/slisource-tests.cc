@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include <boost/dll.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
@@ -23,6 +25,8 @@ SliPresentation::Ptr createPresentation1() {
   // Assign the callbacks to dummy functions to avoid exceptions
   presentation->source->enableInteractions = boost::bind(dummyFunc1);
   presentation->source->disableInteractions = boost::bind(dummyFunc1);
+  // Keep the tests independent of pyramids cached by earlier runs
+  presentation->source->pyramidCache = nullptr;
 
   return presentation;
 }
@@ -46,6 +50,23 @@ void dummyRedraw1(SliPresentation::Ptr presentation) {
   BOOST_REQUIRE(presentation);
 }
 
+void toggleLayer(SliSource::Ptr source, size_t layer) {
+  source->toggled = boost::dynamic_bitset<>{SLI_NOF_LAYERS}.set(layer);
+  source->clearBottomSurface();
+  source->fillCache();
+}
+
+bool sameSurfaces(SliSource::Ptr source1, SliSource::Ptr source2) {
+  for (int zoom = 0; zoom >= -1; zoom--) {
+    auto surface1 = source1->rgbCache[zoom];
+    auto surface2 = source2->rgbCache[zoom];
+    if (memcmp(surface1->getBitmap(), surface2->getBitmap(),
+               surface1->getStride() * surface1->getHeight()) != 0)
+      return false;
+  }
+  return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Tests
 
@@ -165,4 +186,460 @@ BOOST_AUTO_TEST_CASE(slisource_computergb_xoffset) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(slisource_computergb_mapped) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tinycmyk_raw.sli"));
+  dummyRedraw1(presentation);
+  // The layer is an uncompressed TIFF, so it is mapped rather than copied
+  BOOST_REQUIRE(presentation->source->layers[0]->mappedBitmap);
+  BOOST_REQUIRE(presentation->source->layers[0]->bitmap == nullptr);
+  auto surface = presentation->source->getSurface(0)->getBitmap();
+  // bgra conversion of tinycmyk_raw.tif, which holds the same data as
+  // tinycmyk.tif
+  uint8_t tinycmyk[] = {255, 255, 0,   255, 255, 0, 255, 255,
+                        0,   255, 255, 255, 0,   0, 0,   255};
+
+  for (int i = 0; i < 2 * 2 * 4; i++) {
+    BOOST_REQUIRE(surface[i] == tinycmyk[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(slisource_lazy_load_and_evict) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  auto source = presentation->source;
+  dummyRedraw1(presentation);
+  for (auto layer : source->layers)
+    BOOST_REQUIRE(layer->hasBitmap());
+
+  // Hide the first layer while over budget: it gets evicted
+  source->bitmapMemoryBudget = 0;
+  source->toggled = boost::dynamic_bitset<>{SLI_NOF_LAYERS}.set(0);
+  source->clearBottomSurface();
+  source->fillCache();
+  BOOST_REQUIRE(!source->layers[0]->hasBitmap());
+  BOOST_REQUIRE(source->layers[1]->hasBitmap());
+
+  // Showing it again reloads it
+  source->toggled = boost::dynamic_bitset<>{SLI_NOF_LAYERS}.set(0);
+  source->clearBottomSurface();
+  source->fillCache();
+  source->waitForImports(boost::dynamic_bitset<>{SLI_NOF_LAYERS}.set(0));
+  BOOST_REQUIRE(source->layers[0]->hasBitmap());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_parallel_import) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->source->importConcurrency = 2;
+  presentation->load(TestFiles::getPathToFile("sli_septiffmixed.sli"));
+  auto source = presentation->source;
+
+  boost::dynamic_bitset<> all{SLI_NOF_LAYERS};
+  all.set();
+  source->waitForImports(all);
+  BOOST_REQUIRE(source->imported.all());
+  BOOST_REQUIRE(source->importing.none());
+  for (auto layer : source->layers)
+    BOOST_REQUIRE(layer->hasBitmap());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_shared_bitmaps) {
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  presentation2->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+
+  boost::dynamic_bitset<> all{SLI_NOF_LAYERS};
+  all.set();
+  presentation1->source->waitForImports(all);
+  presentation2->source->waitForImports(all);
+
+  // All layers list the same file, so they all share a single bitmap
+  auto first = presentation1->source->layers[0];
+  for (auto &presentation : {presentation1, presentation2}) {
+    for (auto layer : presentation->source->layers) {
+      BOOST_REQUIRE(layer->bitmap == first->bitmap);
+      BOOST_REQUIRE(layer->compressedBitmap == first->compressedBitmap);
+      BOOST_REQUIRE(layer->mappedBitmap == first->mappedBitmap);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(slisource_evict_counts_shared_bitmaps_once) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  auto source = presentation->source;
+  boost::dynamic_bitset<> all{SLI_NOF_LAYERS};
+  all.set();
+  source->waitForImports(all);
+  source->visible.reset();
+
+  // All layers share one bitmap, which fits in the budget
+  size_t bitmapSize = source->layers[0]->getBitmapSize();
+  BOOST_REQUIRE(bitmapSize > 0);
+  source->bitmapMemoryBudget = bitmapSize;
+  source->evictBitmaps();
+  for (auto layer : source->layers)
+    BOOST_REQUIRE(layer->hasBitmap());
+
+  // Just over budget: freeing it takes unloading all of them
+  source->bitmapMemoryBudget = bitmapSize - 1;
+  source->evictBitmaps();
+  for (auto layer : source->layers)
+    BOOST_REQUIRE(!layer->hasBitmap());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_reduce_pyramid) {
+  boost::function<void()> redraw = dummyFunc1;
+  auto source = SliSource::create(redraw);
+  source->total_width = 300;
+  source->total_height = 5000;
+  auto base = SurfaceWrapper::create(300, 5000, CAIRO_FORMAT_ARGB32);
+  for (int i = 0; i < base->getStride() * base->getHeight(); i++)
+    base->getBitmap()[i] = static_cast<uint8_t>((i * 7919) >> 3);
+  source->rgbCache[0] = base;
+
+  // Large enough to be split over two threads
+  source->reducePyramid(base->toRectangle(), true);
+
+  for (int zoom = -1; zoom >= -30; zoom--) {
+    auto target = source->rgbCache[zoom];
+    auto above = source->rgbCache[zoom + 1];
+    BOOST_REQUIRE(target->getWidth() == 300 >> -zoom);
+    BOOST_REQUIRE(target->getHeight() == 5000 >> -zoom);
+    for (int y = 0; y < target->getHeight(); y++) {
+      for (int x = 0; x < target->getWidth() * 4; x++) {
+        uint8_t *a = above->getBitmap() + 2 * y * above->getStride() +
+                     (x / 4) * 8 + x % 4;
+        uint8_t *b = a + above->getStride();
+        int expected = (a[0] + a[4] + b[0] + b[4]) / 4;
+        BOOST_REQUIRE(target->getBitmap()[y * target->getStride() + x] ==
+                      expected);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(slisource_streaming_render) {
+  // Bands of a single tile, composited in parallel
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->source->compositeBandBytes = 1;
+  presentation1->load(TestFiles::getPathToFile("sli_septiffmixed.sli"));
+  BOOST_REQUIRE(!presentation1->source->streamingRender);
+  dummyRedraw1(presentation1);
+
+  // Too little memory for the job, so it is streamed from disk in bands
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->source->bitmapMemoryBudget = 0;
+  presentation2->source->streamBandRows = 7;
+  presentation2->load(TestFiles::getPathToFile("sli_septiffmixed.sli"));
+  BOOST_REQUIRE(presentation2->source->streamingRender);
+  dummyRedraw1(presentation2);
+  BOOST_REQUIRE(presentation2->source->imported.none());
+
+  auto expected = presentation1->source->rgbCache[0];
+  auto actual = presentation2->source->rgbCache[0];
+  BOOST_REQUIRE(memcmp(actual->getBitmap(), expected->getBitmap(),
+                       expected->getStride() * expected->getHeight()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_pyramid_cache) {
+  auto directory = boost::filesystem::temp_directory_path() /
+                   boost::filesystem::unique_path();
+  auto cache = PyramidCache::create(directory);
+
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->source->pyramidCache = cache;
+  presentation1->load(TestFiles::getPathToFile("sli_tinycmyk.sli"));
+  dummyRedraw1(presentation1);
+  // The pyramid is written in the background
+  while (presentation1->source->pyramidStorePending)
+    boost::this_thread::sleep(boost::posix_time::millisec(10));
+  auto key = presentation1->source->pyramidKey(presentation1->source->visible);
+  BOOST_REQUIRE(cache->contains(key));
+
+  // Reopening the same job maps the pyramid instead of compositing it
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->source->pyramidCache = cache;
+  presentation2->load(TestFiles::getPathToFile("sli_tinycmyk.sli"));
+  BOOST_REQUIRE(presentation2->source->importing.none());
+  dummyRedraw1(presentation2);
+  BOOST_REQUIRE(presentation2->source->imported.none());
+
+  for (int zoom = 0; zoom >= -1; zoom--) {
+    auto expected = presentation1->source->rgbCache[zoom];
+    auto actual = presentation2->source->rgbCache[zoom];
+    BOOST_REQUIRE(actual->getWidth() == expected->getWidth());
+    BOOST_REQUIRE(actual->getHeight() == expected->getHeight());
+    BOOST_REQUIRE(memcmp(actual->getBitmap(), expected->getBitmap(),
+                         expected->getStride() * expected->getHeight()) == 0);
+  }
+
+  boost::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_pyramid_over_budget) {
+  auto directory = boost::filesystem::temp_directory_path() /
+                   boost::filesystem::unique_path();
+  auto cache = PyramidCache::create(directory, 1);
+
+  // A pyramid that doesn't fit is not even copied, let alone written
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->source->pyramidCache = cache;
+  presentation->load(TestFiles::getPathToFile("sli_tinycmyk.sli"));
+  dummyRedraw1(presentation);
+  BOOST_REQUIRE(!presentation->source->pyramidStorePending);
+  auto key = presentation->source->pyramidKey(presentation->source->visible);
+  BOOST_REQUIRE(!cache->contains(key));
+  BOOST_REQUIRE(!cache->store(key, presentation->source->rgbCache));
+  BOOST_REQUIRE(!boost::filesystem::exists(directory));
+}
+
+BOOST_AUTO_TEST_CASE(slisource_scrub_checkpoints) {
+  // A checkpoint below every layer but the first, nothing memoized
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->source->checkpointInterval = 1;
+  presentation1->source->stateMemoryBudget = 0;
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation1);
+  auto source1 = presentation1->source;
+  BOOST_REQUIRE(source1->checkpoints.size() == SLI_NOF_LAYERS - 1);
+
+  // Always composites from scratch
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->source->checkpointInterval = 0;
+  presentation2->source->stateMemoryBudget = 0;
+  presentation2->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation2);
+  auto source2 = presentation2->source;
+  BOOST_REQUIRE(source2->checkpoints.empty());
+  BOOST_REQUIRE(sameSurfaces(source1, source2));
+
+  // Scrub down to the first layer and back up again
+  for (size_t j = SLI_NOF_LAYERS - 1; j > 0; j--) {
+    toggleLayer(source1, j);
+    toggleLayer(source2, j);
+    BOOST_REQUIRE(sameSurfaces(source1, source2));
+  }
+  for (size_t j = 1; j < SLI_NOF_LAYERS; j++) {
+    toggleLayer(source1, j);
+    toggleLayer(source2, j);
+    BOOST_REQUIRE(sameSurfaces(source1, source2));
+  }
+  BOOST_REQUIRE(source1->memoizedStates.empty());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_checkpoints_scaled_to_footprint) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  auto source = presentation->source;
+  source->checkpointInterval = 1;
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+
+  // Barely any memory to spare: no checkpoint fits
+  size_t canvas = static_cast<size_t>(source->total_width) *
+                  source->total_height * 4;
+  size_t total = canvas;
+  for (auto &layer : source->layers)
+    total += static_cast<size_t>(layer->width) * layer->height * layer->spp;
+  source->bitmapMemoryBudget = total + canvas;
+  source->checkMemoryFootprint();
+  BOOST_REQUIRE(!source->streamingRender);
+  BOOST_REQUIRE(source->checkpointMemoryBudget < canvas);
+
+  dummyRedraw1(presentation);
+  BOOST_REQUIRE(source->checkpointsCreated);
+  BOOST_REQUIRE(source->checkpoints.empty());
+}
+
+BOOST_AUTO_TEST_CASE(slisource_memoized_states) {
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation1);
+  auto source = presentation1->source;
+  auto expected = SurfaceWrapper::create(
+      source->total_width, source->total_height, CAIRO_FORMAT_ARGB32);
+  auto base = source->rgbCache[0];
+  memcpy(expected->getBitmap(), base->getBitmap(),
+         base->getStride() * base->getHeight());
+
+  toggleLayer(source, 2);
+  BOOST_REQUIRE(source->memoizedStates.size() == 1);
+  BOOST_REQUIRE(source->memoizedStates.front().visible.all());
+
+  // Toggling back is a copy, so the layer doesn't even need to be drawn
+  unsigned int nCompositions = source->nCompositions;
+  toggleLayer(source, 2);
+  BOOST_REQUIRE(source->nCompositions == nCompositions);
+  BOOST_REQUIRE(memcmp(base->getBitmap(), expected->getBitmap(),
+                       base->getStride() * base->getHeight()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_layer_mipmap) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  presentation->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation);
+  auto layer = presentation->source->layers[1];
+  size_t bitmapSize = layer->getBitmapSize();
+
+  const LayerMipmap &mipmap = layer->getMipmap(-1);
+  BOOST_REQUIRE(mipmap.rect.getLeft() == layer->xoffset / 2);
+  BOOST_REQUIRE(mipmap.rect.getTop() == layer->yoffset / 2);
+  BOOST_REQUIRE(layer->getBitmapSize() == bitmapSize + mipmap.data.size());
+
+  // Every sample is the rounded average of a 2x2 square of the canvas
+  std::vector<uint8_t> scratch;
+  const uint8_t *bitmap = layer->getBitmapRows(0, layer->height, scratch);
+  int spp = layer->spp;
+  for (int y = 0; y < mipmap.rect.getHeight(); y++) {
+    for (int x = 0; x < mipmap.rect.getWidth() * spp; x++) {
+      int sum = 0;
+      for (int dy = 0; dy < 2; dy++) {
+        for (int dx = 0; dx < 2; dx++) {
+          int row = 2 * (mipmap.rect.getTop() + y) + dy - layer->yoffset;
+          int column = 2 * (mipmap.rect.getLeft() + x / spp) + dx -
+                       layer->xoffset;
+          if (row >= 0 && row < layer->height && column >= 0 &&
+              column < layer->width)
+            sum += bitmap[(row * layer->width + column) * spp + x % spp];
+        }
+      }
+      BOOST_REQUIRE(mipmap.data[y * mipmap.rect.getWidth() * spp + x] ==
+                    (sum + 2) / 4);
+    }
+  }
+
+  layer->unloadBitmap();
+  BOOST_REQUIRE(layer->mipmaps.empty());
+}
+
+BOOST_AUTO_TEST_CASE(slilayer_read_bitmap_rows) {
+  auto layer = SliLayer::create(TestFiles::getPathToFile("tiff_cmyk.tif"),
+                                "tiff_cmyk", 0, 0);
+  BOOST_REQUIRE(layer->fillMetaFromTiff(8, 4));
+  layer->fillBitmapFromTiff();
+  const size_t stride = static_cast<size_t>(layer->width) * layer->spp;
+
+  std::vector<uint8_t> scratch;
+  for (int row = 0; row < layer->height; row += 7) {
+    int rows = std::min(7, layer->height - row);
+    const uint8_t *data = layer->readBitmapRows(row, rows, scratch);
+    BOOST_REQUIRE(data);
+    BOOST_REQUIRE(memcmp(data, layer->bitmap.get() + row * stride,
+                         rows * stride) == 0);
+  }
+  // The file stays open for the bands that follow
+  BOOST_REQUIRE(layer->rowReader);
+
+  // Rows that can't be read are an error, rather than blank rows
+  BOOST_REQUIRE(!layer->readBitmapRows(layer->height, 1, scratch));
+}
+
+BOOST_AUTO_TEST_CASE(slisource_mipmap_preview) {
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation1);
+  auto source1 = presentation1->source;
+  source1->previewZoom = -1;
+  source1->setViewArea(ViewInterface::WeakPtr(),
+                       source1->rgbCache[0]->toRectangle(), -1);
+
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->source->previewZoom = 0;
+  presentation2->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation2);
+  auto source2 = presentation2->source;
+
+  // The preview draws the visible layers at the viewed level
+  auto level = source1->rgbCache[-1];
+  level->clearSurface();
+  source1->compositePreview(-1, source1->rgbCache[0]->toRectangle());
+  auto *pixels = level->getBitmap();
+  size_t size = level->getStride() * level->getHeight();
+  BOOST_REQUIRE(std::any_of(pixels, pixels + size,
+                            [](uint8_t value) { return value != 0; }));
+
+  // The base level replaces it afterwards
+  toggleLayer(source1, 1);
+  toggleLayer(source2, 1);
+  BOOST_REQUIRE(sameSurfaces(source1, source2));
+}
+
+BOOST_AUTO_TEST_CASE(slisource_bands_sorted_by_views) {
+  SliPresentation::Ptr presentation = createPresentation1();
+  auto source = presentation->source;
+  std::vector<Scroom::Utils::Rectangle<int>> bands;
+  for (int i = 0; i < 10; i++)
+    bands.push_back({0, 10 * i, 100, 10});
+
+  // Without views, the bands stay in raster order
+  BOOST_REQUIRE(source->sortBandsByViews(bands) == 0);
+  BOOST_REQUIRE(bands[0].getTop() == 0);
+
+  source->setViewArea(ViewInterface::WeakPtr(), {20, 62, 10, 15}, 0);
+  BOOST_REQUIRE(source->sortBandsByViews(bands) == 2);
+  BOOST_REQUIRE(bands[0].getTop() == 60);
+  BOOST_REQUIRE(bands[1].getTop() == 70);
+  BOOST_REQUIRE(bands[2].getTop() == 50);
+  BOOST_REQUIRE(bands[3].getTop() == 80);
+}
+
+BOOST_AUTO_TEST_CASE(slisource_viewport_first) {
+  // Single tile bands, with the bottom right corner in view
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->source->compositeBandBytes = 1;
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation1);
+  auto source1 = presentation1->source;
+  int width = source1->total_width;
+  int height = source1->total_height;
+  source1->setViewArea(ViewInterface::WeakPtr(),
+                       {width / 2, height / 2, width / 2, height / 2}, 0);
+
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation2);
+  auto source2 = presentation2->source;
+
+  for (size_t j = 0; j < SLI_NOF_LAYERS; j++) {
+    toggleLayer(source1, j);
+    toggleLayer(source2, j);
+    BOOST_REQUIRE(sameSurfaces(source1, source2));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(slisource_recolor) {
+  // The current colors, with a different cyan
+  ColorTable::Ptr colors = boost::make_shared<ColorTable>();
+  for (auto &color : ColorConfig::getInstance().getColors()->colors) {
+    CustomColor::Ptr copy = boost::make_shared<CustomColor>(*color);
+    if (copy->name == "C")
+      copy->mMultiplier = 0.5;
+    colors->addColor(copy);
+  }
+
+  SliPresentation::Ptr presentation1 = createPresentation1();
+  presentation1->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  dummyRedraw1(presentation1);
+  auto source1 = presentation1->source;
+  toggleLayer(source1, 2);
+  toggleLayer(source1, 2);
+  BOOST_REQUIRE(!source1->memoizedStates.empty());
+
+  // Composited with the new colors from the start
+  SliPresentation::Ptr presentation2 = createPresentation1();
+  presentation2->load(TestFiles::getPathToFile("sli_tiffonly.sli"));
+  for (auto &layer : presentation2->source->layers) {
+    for (auto &channel : layer->channels)
+      channel = colors->find(channel->name);
+  }
+  dummyRedraw1(presentation2);
+  auto source2 = presentation2->source;
+  BOOST_REQUIRE(!sameSurfaces(source1, source2));
+
+  source1->recolor(colors);
+  BOOST_REQUIRE(sameSurfaces(source1, source2));
+  // All memoized states include cyan layers
+  BOOST_REQUIRE(source1->memoizedStates.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <boost/dll.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // Make all private members accessible for testing
 #define private public
@@ -328,4 +330,192 @@ BOOST_AUTO_TEST_CASE(varnish_load_invalid_no_bps_tiff) {
   BOOST_REQUIRE(test_varnishLayer->bitmap == nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(varnish_reduced_surfaces) {
+  SliLayer::Ptr test_varnishLayer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  test_varnishLayer->fillMetaFromTiff(8, 1);
+  test_varnishLayer->fillBitmapFromTiff();
+  Varnish::Ptr test_varnish = Varnish::create(test_varnishLayer);
+
+  // 20x20 is reduced to 10x10, 5x5, 3x3, 2x2 and 1x1, of which the levels
+  // from RESIDENT_LEVEL down are kept when loading
+  BOOST_REQUIRE(test_varnish->smallestLevel == -5);
+  BOOST_REQUIRE(test_varnish->reducedSurfaces.size() == 3);
+  BOOST_REQUIRE(test_varnish->reducedSurfaces.count(-3));
+  BOOST_REQUIRE(test_varnish->reducedBands.all());
+  cairo_surface_t *reduced = Varnish::reduceArea(
+      test_varnish->surface, Scroom::Utils::Rectangle<int>(0, 0, 20, 20), 1);
+  BOOST_REQUIRE(cairo_image_surface_get_width(reduced) == 10);
+  BOOST_REQUIRE(cairo_image_surface_get_height(reduced) == 10);
+
+  // Every pixel averages 2x2 pixels of the full surface
+  int stride = cairo_image_surface_get_stride(test_varnish->surface);
+  int reducedStride = cairo_image_surface_get_stride(reduced);
+  uint8_t *data = cairo_image_surface_get_data(test_varnish->surface);
+  uint8_t *reducedData = cairo_image_surface_get_data(reduced);
+  for (int y = 0; y < 10; y++) {
+    for (int x = 0; x < 10; x++) {
+      int sum = data[2 * y * stride + 2 * x] +
+                data[2 * y * stride + 2 * x + 1] +
+                data[(2 * y + 1) * stride + 2 * x] +
+                data[(2 * y + 1) * stride + 2 * x + 1];
+      BOOST_CHECK(reducedData[y * reducedStride + x] == (sum + 2) / 4);
+    }
+  }
+
+  // The kept levels hold the same as reducing the full surface
+  cairo_surface_t *expected = Varnish::reduceArea(
+      test_varnish->surface, Scroom::Utils::Rectangle<int>(0, 0, 20, 20), 3);
+  std::vector<uint8_t> expectedRow;
+  std::vector<uint8_t> row;
+  for (int y = 0; y < 3; y++) {
+    Varnish::readRow(expected, y, expectedRow);
+    Varnish::readRow(test_varnish->reducedSurfaces[-3], y, row);
+    BOOST_CHECK(row == expectedRow);
+  }
+  cairo_surface_destroy(expected);
+  cairo_surface_destroy(reduced);
+
+  // Zoomed out beyond the smallest level, the 1x1 level is used
+  BOOST_CHECK(test_varnish->getLevel(-2) == -2);
+  BOOST_CHECK(test_varnish->getLevel(-8) == -5);
+  BOOST_CHECK(test_varnish->getLevel(1) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_binary_mask_packed) {
+  // A 40x3 mask that only holds 0 and 255
+  SliLayer::Ptr test_varnishLayer = SliLayer::create("", "Binary", 0, 0);
+  test_varnishLayer->width = 40;
+  test_varnishLayer->height = 3;
+  test_varnishLayer->spp = 1;
+  test_varnishLayer->bps = 8;
+  test_varnishLayer->bitmap.reset(new uint8_t[40 * 3]);
+  for (int i = 0; i < 40 * 3; i++)
+    test_varnishLayer->bitmap[i] = (i % 3 == 0) ? 255 : 0;
+
+  Varnish::Ptr test_varnish = Varnish::create(test_varnishLayer);
+
+  // Stored at a bit per pixel, and the 8-bit bitmap is freed
+  BOOST_REQUIRE(cairo_image_surface_get_format(test_varnish->surface) ==
+                CAIRO_FORMAT_A1);
+  BOOST_REQUIRE(test_varnishLayer->bitmap == nullptr);
+
+  // Read back inverted, like 8-bit masks
+  std::vector<uint8_t> row;
+  for (int y = 0; y < 3; y++) {
+    Varnish::readRow(test_varnish->surface, y, row);
+    BOOST_REQUIRE(row.size() == 40);
+    for (int x = 0; x < 40; x++)
+      BOOST_CHECK(row[x] == (((y * 40 + x) % 3 == 0) ? 0 : 255));
+  }
+
+  // The reduced surfaces hold averages
+  cairo_surface_t *reduced = Varnish::reduceArea(
+      test_varnish->surface, Scroom::Utils::Rectangle<int>(0, 0, 40, 3), 1);
+  BOOST_REQUIRE(cairo_image_surface_get_format(reduced) == CAIRO_FORMAT_A8);
+  BOOST_REQUIRE(cairo_image_surface_get_width(reduced) == 20);
+  BOOST_REQUIRE(cairo_image_surface_get_height(reduced) == 2);
+  Varnish::readRow(reduced, 1, row);
+  // The last row only averages the 2 pixels of row 2: 255 (80) and 0 (81)
+  BOOST_CHECK(row[0] == 128);
+
+  // Part of it, starting at an even column
+  cairo_surface_t *part = Varnish::reduceArea(
+      test_varnish->surface, Scroom::Utils::Rectangle<int>(34, 0, 6, 3), 1);
+  std::vector<uint8_t> expected;
+  Varnish::readRow(reduced, 0, 17, 3, expected);
+  Varnish::readRow(part, 0, row);
+  BOOST_CHECK(row == expected);
+  cairo_surface_destroy(part);
+  cairo_surface_destroy(reduced);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_read_in_bands) {
+  SliLayer::Ptr loadedLayer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  loadedLayer->fillMetaFromTiff(8, 1);
+  loadedLayer->fillBitmapFromTiff();
+  Varnish::Ptr loaded = Varnish::create(loadedLayer);
+
+  // Without the bitmap, the mask is read in bands once drawn, but not before
+  SliLayer::Ptr bandedLayer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  bandedLayer->fillMetaFromTiff(8, 1);
+  Varnish::Ptr banded = Varnish::create(bandedLayer);
+  BOOST_REQUIRE(banded->surface == nullptr);
+  BOOST_CHECK(!bandedLayer->rowReader);
+  BOOST_CHECK(banded->reducedBands.none());
+
+  // The bands hold the same mask
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> row;
+  cairo_surface_t *band = banded->getBand(0);
+  for (int y = 0; y < 20; y++) {
+    Varnish::readRow(loaded->surface, y, expected);
+    Varnish::readRow(band, y, row);
+    BOOST_CHECK(row == expected);
+  }
+  cairo_surface_destroy(band);
+  BOOST_CHECK(banded->bands.size() == 1);
+  // The file is kept open for the next band
+  BOOST_CHECK(bandedLayer->rowReader);
+
+  // And so do the reduced surfaces, which are built once drawn
+  std::vector<Varnish::MaskPart> parts;
+  BOOST_CHECK(!banded->collectMasks(-3, {0, 0, 3, 3}, parts));
+  BOOST_CHECK(parts.empty());
+  auto reduced = [](const Varnish::Ptr &varnish) {
+    boost::mutex::scoped_lock lock(varnish->mtx);
+    return varnish->reducedBands.all();
+  };
+  for (int i = 0; i < 100 && !reduced(banded); i++)
+    boost::this_thread::sleep(boost::posix_time::millisec(10));
+  BOOST_REQUIRE(reduced(banded));
+  BOOST_REQUIRE(banded->collectMasks(-3, {0, 0, 3, 3}, parts));
+  BOOST_REQUIRE(parts.size() == 1);
+  BOOST_CHECK(parts[0].mask == banded->reducedSurfaces[-3]);
+  cairo_surface_destroy(parts[0].mask);
+  Varnish::readRow(loaded->reducedSurfaces[-3], 2, expected);
+  Varnish::readRow(banded->reducedSurfaces[-3], 2, row);
+  BOOST_CHECK(row == expected);
+}
+
+BOOST_AUTO_TEST_CASE(varnish_bands_read_in_background) {
+  SliLayer::Ptr layer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  layer->fillMetaFromTiff(8, 1);
+  Varnish::Ptr varnish = Varnish::create(layer);
+
+  // Drawing doesn't wait for the band, but asks for it
+  cairo_surface_t *band = varnish->findBand(0);
+  BOOST_REQUIRE(!band);
+  for (int i = 0; i < 100 && !band; i++) {
+    boost::this_thread::sleep(boost::posix_time::millisec(10));
+    band = varnish->findBand(0);
+  }
+  BOOST_REQUIRE(band);
+  BOOST_CHECK(cairo_image_surface_get_height(band) == 20);
+  cairo_surface_destroy(band);
+  BOOST_CHECK(varnish->loadingBands.empty());
+}
+
+BOOST_AUTO_TEST_CASE(varnish_failed_band_unvarnished) {
+  SliLayer::Ptr layer = SliLayer::create(
+      TestFiles::getPathToFile("v_valid.tif"), "SomeCoolTitle", 0, 0);
+  layer->fillMetaFromTiff(8, 1);
+  Varnish::Ptr varnish = Varnish::create(layer);
+
+  // The file is gone by the time the band is read
+  layer->filepath = TestFiles::getPathToFile("nonexistent.tif");
+  cairo_surface_t *band = varnish->readBand(0);
+  BOOST_REQUIRE(band);
+  std::vector<uint8_t> row;
+  for (int y = 0; y < 20; y++) {
+    Varnish::readRow(band, y, row);
+    BOOST_CHECK(std::all_of(row.begin(), row.end(),
+                            [](uint8_t value) { return value == 0; }));
+  }
+  cairo_surface_destroy(band);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -1,26 +1,86 @@
 #include "varnish.hh"
+
+#include <algorithm>
+#include <cmath>
+
 #include <gdk/gdk.h>
 #include <scroom/cairo-helpers.hh>
+#include <scroom/threadpool.hh>
 #include <scroom/viewinterface.hh>
 
+namespace {
+/** The bit of pixel @param x within its 32-bit word of an A1 surface */
+inline uint32_t a1Bit(int x) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return 0x80000000u >> (x & 31);
+#else
+  return 1u << (x & 31);
+#endif
+}
+
+/** Size of @param size pixels of zoom level 0 at zoom level @param level */
+inline int reducedSize(int size, int level) {
+  for (; level < 0; level++)
+    size = (size + 1) / 2;
+  return size;
+}
+} // namespace
+
 Varnish::Varnish(const SliLayer::Ptr &sliLayer) {
   this->layer = sliLayer;
   inverted = false;
   // Precalculate the surface and save it.
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_A8, sliLayer->width);
-  surface = cairo_image_surface_create_for_data(
-      sliLayer->bitmap.get(), CAIRO_FORMAT_A8, sliLayer->width,
-      sliLayer->height, stride);
-  // Map is read inverted by cairo, so we invert it here once
-  invertSurface();
+  if (!layer->bitmap) {
+    // Read in bands when drawn
+    surface = nullptr;
+  } else if (isBinary(layer->bitmap.get(), static_cast<size_t>(layer->width) *
+                                               layer->height)) {
+    // Store binary masks at a bit per pixel, cairo masks with those directly
+    surface =
+        createMask(layer->bitmap.get(), layer->width, layer->height, true);
+    layer->unloadBitmap();
+  } else {
+    int stride =
+        cairo_format_stride_for_width(CAIRO_FORMAT_A8, sliLayer->width);
+    surface = cairo_image_surface_create_for_data(
+        sliLayer->bitmap.get(), CAIRO_FORMAT_A8, sliLayer->width,
+        sliLayer->height, stride);
+    // Map is read inverted by cairo, so we invert it here once
+    invertSurface();
+  }
+
+  smallestLevel = 0;
+  for (int width = layer->width, height = layer->height;
+       width > 1 || height > 1; smallestLevel--) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+  for (int level = RESIDENT_LEVEL; level >= smallestLevel; level--) {
+    reducedSurfaces[level] = cairo_image_surface_create(
+        CAIRO_FORMAT_A8, reducedSize(layer->width, level),
+        reducedSize(layer->height, level));
+  }
+
+  // Build the reduced surfaces now, so drawing never has to
+  const int nBands = (layer->height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+  reducedBands.resize(nBands);
+  for (int index = 0; surface && index < nBands; index++)
+    reduceBand(index, surface, index * BAND_HEIGHT);
 }
 
 Varnish::Ptr Varnish::create(const SliLayer::Ptr &layer) {
   Varnish::Ptr result = Ptr(new Varnish(layer));
+  result->self = result;
   return result;
 }
 
-Varnish::~Varnish() { cairo_surface_destroy(surface); }
+Varnish::~Varnish() {
+  cairo_surface_destroy(surface);
+  for (auto &level : reducedSurfaces)
+    cairo_surface_destroy(level.second);
+  for (auto &band : bands)
+    cairo_surface_destroy(band.second);
+}
 
 void Varnish::setView(const ViewInterface::WeakPtr &viewWeakPtr) {
   registerUI(viewWeakPtr);
@@ -49,20 +109,11 @@ static void varnish_toggled(GtkToggleButton *, gpointer varnishP) {
 }
 
 void Varnish::fixVarnishState() {
-  if (inverted) {
-    // If we're currently inverted and moving to normal,
-    // We need to invert back
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_enabled))) {
-      invertSurface();
-      inverted = false;
-    }
-  } else {
-    // If we're currently normal and moving to normal,
-    // We need to invert back
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_inverted))) {
-      invertSurface();
-      inverted = true;
-    }
+  // The mask is left as is, drawOverlay() inverts it while drawing
+  if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_enabled))) {
+    inverted = false;
+  } else if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_inverted))) {
+    inverted = true;
   }
 }
 
@@ -121,14 +172,384 @@ void Varnish::invertSurface() {
   cairo_surface_flush(surface);
   int width = cairo_image_surface_get_width(surface);
   int height = cairo_image_surface_get_height(surface);
+  int stride = cairo_image_surface_get_stride(surface);
   unsigned char *data = cairo_image_surface_get_data(surface);
-  for (int i = 0; i < width * height; i++) {
-    // Invert each suface pixel.
-    data[i] ^= 255;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // Invert each suface pixel.
+      data[y * stride + x] ^= 255;
+    }
   }
   cairo_surface_mark_dirty(surface);
 }
 
+bool Varnish::isBinary(const uint8_t *data, size_t size) {
+  return std::all_of(data, data + size,
+                     [](uint8_t value) { return value == 0 || value == 255; });
+}
+
+cairo_surface_t *Varnish::createMask(const uint8_t *data, int width,
+                                     int height, bool binary) {
+  cairo_surface_t *mask = cairo_image_surface_create(
+      binary ? CAIRO_FORMAT_A1 : CAIRO_FORMAT_A8, width, height);
+  cairo_surface_flush(mask);
+  const int stride = cairo_image_surface_get_stride(mask);
+  uint8_t *maskData = cairo_image_surface_get_data(mask);
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = data + y * width;
+    uint8_t *maskRow = maskData + y * stride;
+    auto *words = reinterpret_cast<uint32_t *>(maskRow);
+    for (int x = 0; x < width; x++) {
+      // Map is read inverted by cairo, so invert it here
+      if (!binary)
+        maskRow[x] = row[x] ^ 255;
+      else if (row[x] == 0)
+        words[x / 32] |= a1Bit(x);
+    }
+  }
+  cairo_surface_mark_dirty(mask);
+  return mask;
+}
+
+cairo_surface_t *Varnish::useBand(int index) {
+  auto it = bands.find(index);
+  if (it == bands.end())
+    return nullptr;
+  recentBands.remove(index);
+  recentBands.push_front(index);
+  return cairo_surface_reference(it->second);
+}
+
+cairo_surface_t *Varnish::getBand(int index) {
+  {
+    boost::mutex::scoped_lock lock(mtx);
+    if (cairo_surface_t *band = useBand(index))
+      return band;
+  }
+  cairo_surface_t *band = readBand(index);
+  boost::mutex::scoped_lock lock(mtx);
+  return addBand(index, band);
+}
+
+cairo_surface_t *Varnish::findBand(int index) {
+  boost::mutex::scoped_lock lock(mtx);
+  cairo_surface_t *band = useBand(index);
+  if (!band && loadingBands.insert(index).second) {
+    boost::weak_ptr<Varnish> weak = self;
+    CpuBound()->schedule(
+        [weak, index]() {
+          if (Ptr varnish = weak.lock())
+            varnish->loadBand(index);
+        },
+        PRIO_HIGHER);
+  }
+  return band;
+}
+
+cairo_surface_t *Varnish::readBand(int index) {
+  const int top = index * BAND_HEIGHT;
+  const int rows = std::min(BAND_HEIGHT, layer->height - top);
+  std::vector<uint8_t> scratch;
+  const uint8_t *data = layer->readBitmapRows(top, rows, scratch);
+  if (!data) {
+    // Already reported, leave the band unvarnished. The mask is inverted, so
+    // that takes samples of 255.
+    scratch.assign(static_cast<size_t>(layer->width) * rows, 255);
+    data = scratch.data();
+  }
+  return createMask(data, layer->width, rows,
+                    isBinary(data, static_cast<size_t>(layer->width) * rows));
+}
+
+cairo_surface_t *Varnish::addBand(int index, cairo_surface_t *band) {
+  auto it = bands.find(index);
+  if (it != bands.end()) {
+    // Read by another thread meanwhile
+    cairo_surface_destroy(band);
+    band = it->second;
+  } else {
+    bands[index] = band;
+    bandBytes += static_cast<size_t>(cairo_image_surface_get_stride(band)) *
+                 cairo_image_surface_get_height(band);
+  }
+  recentBands.remove(index);
+  recentBands.push_front(index);
+
+  // Drop the least recently used bands, but never the one just added. Bands
+  // that are still being drawn live on until they are done with.
+  while (bandBytes > bandMemoryBudget && recentBands.size() > 1) {
+    cairo_surface_t *oldest = bands[recentBands.back()];
+    bandBytes -= static_cast<size_t>(cairo_image_surface_get_stride(oldest)) *
+                 cairo_image_surface_get_height(oldest);
+    cairo_surface_destroy(oldest);
+    bands.erase(recentBands.back());
+    recentBands.pop_back();
+  }
+  return cairo_surface_reference(band);
+}
+
+void Varnish::loadBand(int index) {
+  cairo_surface_t *band = readBand(index);
+  {
+    boost::mutex::scoped_lock lock(mtx);
+    cairo_surface_destroy(addBand(index, band));
+    loadingBands.erase(index);
+  }
+  if (triggerRedraw)
+    triggerRedraw();
+}
+
+void Varnish::buildReducedSurfaces() {
+  while (true) {
+    int index;
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      if (queuedReductions.empty()) {
+        reducing = false;
+        return;
+      }
+      index = *queuedReductions.begin();
+      queuedReductions.erase(queuedReductions.begin());
+    }
+
+    cairo_surface_t *band = getBand(index);
+    reduceBand(index, band, 0);
+    cairo_surface_destroy(band);
+    if (triggerRedraw)
+      triggerRedraw();
+  }
+}
+
+void Varnish::queueReduction(int index) {
+  if (reducedBands[index] || !queuedReductions.insert(index).second ||
+      reducing)
+    return;
+
+  reducing = true;
+  boost::weak_ptr<Varnish> weak = self;
+  CpuBound()->schedule(
+      [weak]() {
+        if (Ptr varnish = weak.lock())
+          varnish->buildReducedSurfaces();
+      },
+      PRIO_LOW);
+}
+
+void Varnish::reduceBand(int index, cairo_surface_t *source, int sourceTop) {
+  if (smallestLevel > RESIDENT_LEVEL)
+    return;
+
+  // The bands start at a multiple of every resident level, so the finest one
+  // is reduced from the band alone
+  const int top = index * BAND_HEIGHT;
+  const int rows = std::min(BAND_HEIGHT, layer->height - top);
+  cairo_surface_t *strip = reduceArea(
+      source, Scroom::Utils::Rectangle<int>(0, sourceTop, layer->width, rows),
+      -RESIDENT_LEVEL);
+  cairo_surface_t *resident = reducedSurfaces[RESIDENT_LEVEL];
+  cairo_surface_flush(resident);
+  const int stride = cairo_image_surface_get_stride(resident);
+  const int stripStride = cairo_image_surface_get_stride(strip);
+  uint8_t *data = cairo_image_surface_get_data(resident) +
+                  (top >> -RESIDENT_LEVEL) * stride;
+  const uint8_t *stripData = cairo_image_surface_get_data(strip);
+  for (int y = 0; y < cairo_image_surface_get_height(strip); y++) {
+    std::copy(stripData + y * stripStride,
+              stripData + y * stripStride +
+                  cairo_image_surface_get_width(strip),
+              data + y * stride);
+  }
+  cairo_surface_mark_dirty(resident);
+  cairo_surface_destroy(strip);
+
+  // The rows of the smaller levels may span several bands. They are complete
+  // once the last of those has been reduced.
+  for (int level = RESIDENT_LEVEL - 1; level >= smallestLevel; level--) {
+    cairo_surface_t *above = reducedSurfaces[level + 1];
+    const int first = top >> -level;
+    const int last = (top + rows - 1) >> -level;
+    Scroom::Utils::Rectangle<int> area =
+        Scroom::Utils::Rectangle<int>(0, 2 * first,
+                                      cairo_image_surface_get_width(above),
+                                      2 * (last - first + 1))
+            .intersection(Scroom::Utils::Rectangle<int>(
+                0, 0, cairo_image_surface_get_width(above),
+                cairo_image_surface_get_height(above)));
+    reduceArea(above, area, reducedSurfaces[level], first);
+  }
+
+  boost::mutex::scoped_lock lock(mtx);
+  reducedBands.set(index);
+}
+
+void Varnish::readRow(cairo_surface_t *source, int y,
+                      std::vector<uint8_t> &row) {
+  readRow(source, y, 0, cairo_image_surface_get_width(source), row);
+}
+
+void Varnish::readRow(cairo_surface_t *source, int y, int left, int width,
+                      std::vector<uint8_t> &row) {
+  const uint8_t *data = cairo_image_surface_get_data(source) +
+                        y * cairo_image_surface_get_stride(source);
+  row.resize(width);
+  if (cairo_image_surface_get_format(source) == CAIRO_FORMAT_A1) {
+    const auto *words = reinterpret_cast<const uint32_t *>(data);
+    for (int x = 0; x < width; x++) {
+      const int column = left + x;
+      row[x] = (words[column / 32] & a1Bit(column)) ? 255 : 0;
+    }
+  } else {
+    std::copy(data + left, data + left + width, row.begin());
+  }
+}
+
+void Varnish::reduceArea(cairo_surface_t *source,
+                         const Scroom::Utils::Rectangle<int> &area,
+                         cairo_surface_t *target, int targetTop) {
+  cairo_surface_flush(source);
+  cairo_surface_flush(target);
+  const int width = area.getWidth();
+  const int height = area.getHeight();
+  const int targetStride = cairo_image_surface_get_stride(target);
+  uint8_t *targetData =
+      cairo_image_surface_get_data(target) + targetTop * targetStride;
+
+  std::vector<uint8_t> top;
+  std::vector<uint8_t> bottom;
+  for (int y = 0; 2 * y < height; y++) {
+    // The last row and column may lack a neighbour to average with
+    const int rows = std::min(2, height - 2 * y);
+    readRow(source, area.getTop() + 2 * y, area.getLeft(), width, top);
+    if (rows == 2)
+      readRow(source, area.getTop() + 2 * y + 1, area.getLeft(), width,
+              bottom);
+    for (int x = 0; 2 * x < width; x++) {
+      const int columns = std::min(2, width - 2 * x);
+      int sum = 0;
+      for (int i = 0; i < columns; i++) {
+        sum += top[2 * x + i];
+        if (rows == 2)
+          sum += bottom[2 * x + i];
+      }
+      const int count = rows * columns;
+      targetData[y * targetStride + x] =
+          static_cast<uint8_t>((sum + count / 2) / count);
+    }
+  }
+  cairo_surface_mark_dirty(target);
+}
+
+cairo_surface_t *Varnish::reduceArea(cairo_surface_t *source,
+                                     Scroom::Utils::Rectangle<int> area,
+                                     int levels) {
+  cairo_surface_t *result = cairo_surface_reference(source);
+  for (int level = 0; level < levels; level++) {
+    cairo_surface_t *target = cairo_image_surface_create(
+        CAIRO_FORMAT_A8, (area.getWidth() + 1) / 2, (area.getHeight() + 1) / 2);
+    reduceArea(result, area, target, 0);
+    cairo_surface_destroy(result);
+    result = target;
+    area = Scroom::Utils::Rectangle<int>(
+        0, 0, cairo_image_surface_get_width(target),
+        cairo_image_surface_get_height(target));
+  }
+  return result;
+}
+
+int Varnish::getLevel(int zoom) const {
+  // Below the smallest level, cairo scales that one down further
+  return std::min(0, std::max(zoom, smallestLevel));
+}
+
+bool Varnish::collectMasks(int level,
+                           const Scroom::Utils::Rectangle<int> &visible,
+                           std::vector<MaskPart> &parts) {
+  const int shift = -level;
+  if (level <= RESIDENT_LEVEL) {
+    // A row is drawn once all bands it spans have been reduced. The others
+    // are reduced in the background.
+    cairo_surface_t *reduced = reducedSurfaces[level];
+    const int lastBand = static_cast<int>(reducedBands.size()) - 1;
+    bool complete = true;
+    int runTop = visible.getTop();
+    boost::mutex::scoped_lock lock(mtx);
+    for (int y = visible.getTop(); y <= visible.getBottom(); y++) {
+      bool done = y < visible.getBottom();
+      if (done) {
+        const int first = (y << shift) / BAND_HEIGHT;
+        const int last =
+            std::min(lastBand, (((y + 1) << shift) - 1) / BAND_HEIGHT);
+        for (int index = first; index <= last; index++) {
+          if (!reducedBands[index]) {
+            queueReduction(index);
+            done = false;
+          }
+        }
+      }
+      if (!done) {
+        complete &= y == visible.getBottom();
+        if (runTop < y) {
+          parts.push_back({cairo_surface_reference(reduced),
+                           {0, 0},
+                           {visible.getLeft(), runTop, visible.getWidth(),
+                            y - runTop}});
+        }
+        runTop = y + 1;
+      }
+    }
+    return complete;
+  }
+
+  // The levels above RESIDENT_LEVEL are reduced for the visible part only,
+  // in pixels of zoom level 0
+  Scroom::Utils::Rectangle<int> area =
+      Scroom::Utils::Rectangle<int>(
+          visible.getLeft() << shift, visible.getTop() << shift,
+          visible.getWidth() << shift, visible.getHeight() << shift)
+          .intersection(
+              Scroom::Utils::Rectangle<int>(0, 0, layer->width, layer->height));
+  if (surface && level == 0) {
+    parts.push_back({cairo_surface_reference(surface), {0, 0}, visible});
+    return true;
+  }
+  if (surface) {
+    parts.push_back({reduceArea(surface, area, shift),
+                     {area.getLeft() >> shift, area.getTop() >> shift},
+                     visible});
+    return true;
+  }
+
+  // Bands that haven't been read yet are read in the background
+  bool complete = true;
+  for (int index = area.getTop() / BAND_HEIGHT;
+       index * BAND_HEIGHT < area.getBottom(); index++) {
+    cairo_surface_t *band = findBand(index);
+    if (!band) {
+      complete = false;
+      continue;
+    }
+    const int top = index * BAND_HEIGHT;
+    Scroom::Utils::Rectangle<int> bandArea =
+        area.intersection(Scroom::Utils::Rectangle<int>(
+            0, top, layer->width, cairo_image_surface_get_height(band)));
+    // The rows of the band, in pixels of the zoom level
+    Scroom::Utils::Rectangle<int> drawn =
+        visible.intersection(Scroom::Utils::Rectangle<int>(
+            visible.getLeft(), bandArea.getTop() >> shift, visible.getWidth(),
+            reducedSize(bandArea.getHeight(), level)));
+    if (level == 0) {
+      parts.push_back({band, {0, top}, drawn});
+      continue;
+    }
+    parts.push_back(
+        {reduceArea(band, bandArea - Scroom::Utils::Point<int>(0, top), shift),
+         {bandArea.getLeft() >> shift, bandArea.getTop() >> shift},
+         drawn});
+    cairo_surface_destroy(band);
+  }
+  return complete;
+}
+
 void Varnish::drawOverlay(ViewInterface::Ptr const &, cairo_t *cr,
                           Scroom::Utils::Rectangle<double> presentationArea,
                           int zoom) {
@@ -143,10 +564,13 @@ void Varnish::drawOverlay(ViewInterface::Ptr const &, cairo_t *cr,
   cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
   cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
   cairo_translate(cr, -GTKPresArea.x * pixelSize, -GTKPresArea.y * pixelSize);
+  // Mask with the reduced surface matching the zoom level, so the amount of
+  // work depends on the number of screen pixels rather than image pixels
+  const int level = getLevel(zoom);
   if (zoom >= 0) {
     cairo_scale(cr, 1 << zoom, 1 << zoom);
   } else {
-    cairo_scale(cr, pow(2.0, zoom), pow(2.0, zoom));
+    cairo_scale(cr, pow(2.0, zoom - level), pow(2.0, zoom - level));
   }
 
   // Read the overlay color and alpha
@@ -164,15 +588,86 @@ void Varnish::drawOverlay(ViewInterface::Ptr const &, cairo_t *cr,
   b = color.blue / 65535.0;
   a = alpha / 65535.0;
 
+  // Only the part of the mask that is visible is drawn (in units of the mask)
+  double scale = pow(2.0, level);
+  int maskWidth = reducedSize(layer->width, level);
+  int maskHeight = reducedSize(layer->height, level);
+  Scroom::Utils::Rectangle<int> visible =
+      Scroom::Utils::Rectangle<int>(
+          static_cast<int>(floor(presentationArea.getLeft() * scale)),
+          static_cast<int>(floor(presentationArea.getTop() * scale)),
+          static_cast<int>(ceil(presentationArea.getWidth() * scale)) + 1,
+          static_cast<int>(ceil(presentationArea.getHeight() * scale)) + 1)
+          .intersection(
+              Scroom::Utils::Rectangle<int>(0, 0, maskWidth, maskHeight));
+  if (visible.getWidth() <= 0 || visible.getHeight() <= 0) {
+    cairo_restore(cr);
+    return;
+  }
+
+  // The parts that haven't arrived yet are drawn once they do
+  std::vector<MaskPart> parts;
+  collectMasks(level, visible, parts);
+  auto maskVisible = [&]() {
+    for (auto &part : parts)
+      maskRegion(cr, part, visible);
+  };
+
+  // The reduced masks may extend up to a pixel beyond the layer
+  double right = std::min<double>(visible.getRight(), layer->width * scale);
+  double bottom = std::min<double>(visible.getBottom(), layer->height * scale);
+
   if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check_show_background))) {
     // Clear the background
-    cairo_rectangle(cr, 0, 0, layer->width, layer->height);
+    cairo_rectangle(cr, visible.getLeft(), visible.getTop(),
+                    right - visible.getLeft(), bottom - visible.getTop());
     cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
     cairo_fill(cr);
   }
 
   cairo_set_source_rgba(cr, r, g, b, a);
-  cairo_mask_surface(cr, surface, 0, 0);
+  if (inverted) {
+    // Paint the color over the visible part of the layer that has arrived
+    // and cut the mask out of it. The mask itself is never rewritten.
+    cairo_push_group(cr);
+    for (auto &part : parts) {
+      Scroom::Utils::Rectangle<int> area = part.area.intersection(visible);
+      if (area.getWidth() <= 0 || area.getHeight() <= 0)
+        continue;
+      cairo_rectangle(cr, area.getLeft(), area.getTop(),
+                      std::min<double>(area.getRight(), right) - area.getLeft(),
+                      std::min<double>(area.getBottom(), bottom) -
+                          area.getTop());
+    }
+    cairo_fill(cr);
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_DEST_OUT);
+    maskVisible();
+    cairo_pop_group_to_source(cr);
+    cairo_paint(cr);
+  } else {
+    maskVisible();
+  }
 
+  for (auto &part : parts)
+    cairo_surface_destroy(part.mask);
   cairo_restore(cr);
 }
+
+void Varnish::maskRegion(cairo_t *cr, const MaskPart &part,
+                         const Scroom::Utils::Rectangle<int> &visible) {
+  Scroom::Utils::Rectangle<int> region =
+      visible.intersection(part.area)
+          .intersection(Scroom::Utils::Rectangle<int>(
+              part.origin.x, part.origin.y,
+              cairo_image_surface_get_width(part.mask),
+              cairo_image_surface_get_height(part.mask)));
+  if (region.getWidth() <= 0 || region.getHeight() <= 0)
+    return;
+
+  cairo_surface_t *visibleMask = cairo_surface_create_for_rectangle(
+      part.mask, region.getLeft() - part.origin.x,
+      region.getTop() - part.origin.y, region.getWidth(), region.getHeight());
+  cairo_mask_surface(cr, visibleMask, region.getLeft(), region.getTop());
+  cairo_surface_destroy(visibleMask);
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <list>
+#include <set>
+
+#include <boost/dynamic_bitset.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include "../sli/slilayer.hh"
 #include <gtk/gtk.h>
 
@@ -20,13 +26,202 @@ private:
   GtkWidget *radio_inverted;
   GtkWidget *check_show_background;
   GtkWidget *colorpicker;
+  /** Inverts the mask. Only done once, when loading. */
   void invertSurface();
   void registerUI(const ViewInterface::WeakPtr &viewWeakPtr);
   SliLayer::Ptr layer;
+
+  /**
+   * The full resolution mask. Masks that only hold 0 and 255 are stored as a
+   * CAIRO_FORMAT_A1 surface, packed 32 pixels to a word, others as
+   * CAIRO_FORMAT_A8. Null if the layer bitmap wasn't loaded, see bands.
+   */
   cairo_surface_t *surface;
+
+  /**
+   * Reduced copies of the mask, by zoom level, from RESIDENT_LEVEL down to
+   * smallestLevel. Every pixel averages 2x2 pixels of the level above. They
+   * are built band by band, when loading, or if the mask is read in bands,
+   * in the background for the bands that are drawn. The levels above
+   * RESIDENT_LEVEL are only reduced for the part being drawn.
+   */
+  std::map<int, cairo_surface_t *> reducedSurfaces;
+
+  /** Bitmask of the bands that have been reduced into reducedSurfaces */
+  boost::dynamic_bitset<> reducedBands;
+
+  /** Zoom level of the smallest reduced surface, which is a single pixel */
+  int smallestLevel;
+
   bool inverted;
 
+  /**
+   * Bands of BAND_HEIGHT rows of the full resolution mask, by index. Only
+   * used when the layer bitmap wasn't loaded, in which case they are read
+   * from the TIFF file in the background when they are first drawn.
+   */
+  std::map<int, cairo_surface_t *> bands;
+
+  /** Indexes of the bands, most recently used first */
+  std::list<int> recentBands;
+
+  /** Indexes of the bands being read in the background */
+  std::set<int> loadingBands;
+
+  /** Indexes of the bands waiting to be reduced in the background */
+  std::set<int> queuedReductions;
+
+  /** Whether a buildReducedSurfaces() task is running */
+  bool reducing = false;
+
+  /** Number of bytes held by bands */
+  size_t bandBytes = 0;
+
+  /**
+   * Protects bands, recentBands, loadingBands, bandBytes, reducedBands,
+   * queuedReductions and reducing, which background tasks fill in
+   */
+  boost::mutex mtx;
+
+  /** This varnish itself, for the background tasks */
+  boost::weak_ptr<Varnish> self;
+
+  /** Whether the @param size bytes at @param data only hold 0 and 255 */
+  static bool isBinary(const uint8_t *data, size_t size);
+
+  /**
+   * Creates an inverted mask from @param height rows of @param width bytes
+   * at @param data. Masks that are @param binary, see isBinary(), are packed
+   * into an A1 surface.
+   */
+  static cairo_surface_t *createMask(const uint8_t *data, int width,
+                                     int height, bool binary);
+
+  /**
+   * Returns a reference to band @param index, reading it from the TIFF file
+   * if needed. The caller destroys the reference.
+   */
+  cairo_surface_t *getBand(int index);
+
+  /**
+   * Returns a reference to band @param index and marks it as most recently
+   * used, or null if it hasn't been read. Requires mtx to be held.
+   */
+  cairo_surface_t *useBand(int index);
+
+  /**
+   * Returns a reference to band @param index if it has been read, and
+   * schedules reading it otherwise. The caller destroys the reference.
+   */
+  cairo_surface_t *findBand(int index);
+
+  /** Reads band @param index from the TIFF file, without adding it */
+  cairo_surface_t *readBand(int index);
+
+  /**
+   * Adds @param band as band @param index, dropping the least recently used
+   * bands if over budget. Requires mtx to be held.
+   * @return a reference to the band, which may have been added meanwhile
+   */
+  cairo_surface_t *addBand(int index, cairo_surface_t *band);
+
+  /** Reads band @param index in the background, then triggers a redraw */
+  void loadBand(int index);
+
+  /**
+   * Reduces the queued bands into the reduced surfaces in the background,
+   * triggering a redraw after each
+   */
+  void buildReducedSurfaces();
+
+  /**
+   * Queues band @param index to be reduced in the background, unless it is
+   * already. Requires mtx to be held.
+   */
+  void queueReduction(int index);
+
+  /**
+   * Reduces band @param index into reducedSurfaces. Its rows are read from
+   * @param source, starting at row @param sourceTop.
+   */
+  void reduceBand(int index, cairo_surface_t *source, int sourceTop);
+
+  /** A mask that draws part of the overlay */
+  struct MaskPart {
+    /** The mask, which the drawing code destroys a reference of */
+    cairo_surface_t *mask;
+
+    /** Where the top left pixel of mask goes, in pixels of its zoom level */
+    Scroom::Utils::Point<int> origin;
+
+    /** The part of the overlay it draws, in pixels of its zoom level */
+    Scroom::Utils::Rectangle<int> area;
+  };
+
+  /**
+   * Collects the masks that cover @param visible (in pixels of zoom level
+   * @param level) in @param parts. Bands that haven't been read or reduced
+   * yet are in the background, and left out until they are.
+   * @return false if some part isn't available yet
+   */
+  bool collectMasks(int level, const Scroom::Utils::Rectangle<int> &visible,
+                    std::vector<MaskPart> &parts);
+
+  /** Masks the part of @param visible covered by @param part */
+  static void maskRegion(cairo_t *cr, const MaskPart &part,
+                         const Scroom::Utils::Rectangle<int> &visible);
+
+  /** Reads row @param y of an A8 or A1 surface as one byte per pixel */
+  static void readRow(cairo_surface_t *source, int y,
+                      std::vector<uint8_t> &row);
+
+  /**
+   * Reads @param width pixels of row @param y of an A8 or A1 surface,
+   * starting at column @param left, as one byte per pixel
+   */
+  static void readRow(cairo_surface_t *source, int y, int left, int width,
+                      std::vector<uint8_t> &row);
+
+  /**
+   * Averages every 2x2 pixels of @param area (at even coordinates) of
+   * @param source into a pixel of @param target, starting at its top left
+   * pixel of row @param targetTop. The last row and column of the area may
+   * lack a neighbour to average with.
+   */
+  static void reduceArea(cairo_surface_t *source,
+                         const Scroom::Utils::Rectangle<int> &area,
+                         cairo_surface_t *target, int targetTop);
+
+  /**
+   * Returns a new A8 surface with @param area (at even coordinates) of
+   * @param source reduced @param levels times, or a reference to
+   * @param source if @param levels is 0.
+   */
+  static cairo_surface_t *reduceArea(cairo_surface_t *source,
+                                     Scroom::Utils::Rectangle<int> area,
+                                     int levels);
+
+  /** Returns the zoom level of the mask to draw at zoom level @param zoom */
+  int getLevel(int zoom) const;
+
 public:
+  /** Number of rows in a band */
+  static const int BAND_HEIGHT = 256;
+
+  /**
+   * The largest reduced level that is kept. The ones above it take more
+   * memory than a packed mask, so only the part being drawn is reduced.
+   */
+  static const int RESIDENT_LEVEL = -3;
+
+  /** Number of bytes the bands may occupy before the least recent go */
+  size_t bandMemoryBudget = static_cast<size_t>(64) * 1024 * 1024;
+
+  /**
+   * Constructor. If the bitmap of @param layer wasn't loaded, the mask is
+   * read from the file in bands, in the background, once they are drawn.
+   * Nothing is read while the overlay is disabled.
+   */
   static Ptr create(const SliLayer::Ptr &layer);
   void setView(const ViewInterface::WeakPtr &viewWeakPtr);
   void resetView(const ViewInterface::WeakPtr &viewWeakPtr);